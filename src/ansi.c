@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <termbox.h>
+
+#include "emulator.h"
+#include "asm.h"
+
+#define FRAME_NS                  (1000000000L / TIMER_HZ)
+#define DEFAULT_CYCLES_PER_FRAME  10
+
+// Terminals only report key presses (and autorepeats), never releases, so
+// a key counts as held for this many frames after its last press
+#define DEFAULT_HOLD_FRAMES       10
+
+#define UPPER_HALF   0x2580 // '▀': foreground is the top pixel, background the bottom one
+
+// Colour per EmuDisplay_pixel index: off, plane 0, plane 1, both
+static const uint16_t PALETTE[1 << SCREEN_PLANES] = { TB_BLACK, TB_WHITE, TB_BLUE, TB_CYAN };
+
+Emulator emu;
+
+// What the terminal currently shows, to send only the cells that changed
+uint8_t shown[HIRES_WIDTH * HIRES_HEIGHT];
+bool    shownValid = false;
+bool    shownHires = false;
+
+int keyTimers[16];
+
+int getKeyIndex(uint32_t ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void drawText(int x, int y, const char* text) {
+    for (; *text; text++, x++) {
+        tb_change_cell(x, y, (uint8_t)*text, TB_DEFAULT, TB_DEFAULT);
+    }
+}
+
+/**
+ * Clears the terminal and puts the key help under the screen, which is
+ * half as many cells tall as it has pixel rows.
+ */
+void drawChrome() {
+    tb_clear();
+    drawText(0, EmuDisplay_height(&emu.display) / 2, "0-9 a-f: keys   ESC: quit");
+    shownValid = false;
+}
+
+/**
+ * Updates the cells whose pixel pair changed since the last present and
+ * returns how many that was. tb_present only writes those out.
+ */
+int drawScreen() {
+    if (emu.display.hires != shownHires) { // the help line moves with the screen's height
+        shownHires = emu.display.hires;
+        drawChrome();
+    }
+
+    int width  = EmuDisplay_width(&emu.display);
+    int height = EmuDisplay_height(&emu.display);
+    int changed = 0;
+    for (int row = 0; row < height / 2; row++) {
+        uint8_t* shownTop    = shown + (row * 2) * width;
+        uint8_t* shownBottom = shownTop + width;
+
+        for (int x = 0; x < width; x++) {
+            uint8_t top    = EmuDisplay_pixel(&emu.display, x, row * 2);
+            uint8_t bottom = EmuDisplay_pixel(&emu.display, x, row * 2 + 1);
+            if (shownValid && top == shownTop[x] && bottom == shownBottom[x]) continue;
+
+            tb_change_cell(x, row, UPPER_HALF, PALETTE[top], PALETTE[bottom]);
+            shownTop[x]    = top;
+            shownBottom[x] = bottom;
+            changed++;
+        }
+    }
+    shownValid = true;
+    return changed;
+}
+
+/**
+ * Shortcut string equality, to be used only with string literals
+ * for second argument.
+ */
+bool streq(const char* a, const char* b) {
+    return strncmp(a, b, strlen(b)) == 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* filename = "roms/bin/Maze.ch8";
+    int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    int holdFrames     = DEFAULT_HOLD_FRAMES;
+    EmuPlatform platform;
+    bool        platformSet = false;
+
+    if (argc > 1) {
+        for (int i = 0; i < argc - 1; i++) {
+            if (streq(argv[i], "-cpf") && i + 1 < argc) {
+                cyclesPerFrame = atoi(argv[i+1]);
+                if (cyclesPerFrame < 1) cyclesPerFrame = 1;
+            }
+            else if (streq(argv[i], "-hold") && i + 1 < argc) {
+                holdFrames = atoi(argv[i+1]);
+                if (holdFrames < 1) holdFrames = 1;
+            }
+            else if (streq(argv[i], "-p") && i + 1 < argc) {
+                platformSet = Emulator_parsePlatform(argv[i+1], &platform);
+                if (!platformSet) printf("Unknown platform %s; expected chip8, schip or xochip\n", argv[i+1]);
+            }
+        }
+
+        filename = argv[argc-1];
+    }
+    if (!platformSet) platform = Emulator_guessPlatform(filename);
+
+    { // Initialize emulator
+        if (!Emulator_init(&emu, platform)) {
+            printf("Out of memory\n");
+            return 1;
+        }
+    }
+
+    { // Load ROM
+        size_t len = strlen(filename);
+        bool isSource = (len > 4 && strcmp(filename + len - 4, ".src") == 0) ||
+                        (len > 4 && strcmp(filename + len - 4, ".asm") == 0);
+
+        if (isSource) { // Assemble in process, following INCLUDEs
+            AsmRom* assembled = malloc(sizeof(AsmRom));
+            if (!Asm_build(filename, NULL, assembled)) {
+                const char* file = assembled->errorFile[0] ? assembled->errorFile : filename;
+                printf("%s:%u: %s\n", file, assembled->errorLine, assembled->error);
+                return 1;
+            }
+            Emulator_loadRom(&emu, assembled->bytes, assembled->size);
+            free(assembled);
+        } else {
+            FILE* rom = fopen(filename, "rb");
+            if (rom == NULL) {
+                printf("Couldn't open file\n");
+                return 1;
+            }
+
+            static uint8_t data[XO_MAX_ROM_SIZE + 1];
+            size_t size = fread(data, 1, sizeof(data), rom);
+            fclose(rom);
+            if (size > Emulator_maxRomSize(&emu)) {
+                printf("ROM too big!\n");
+                return 1;
+            }
+            Emulator_loadRom(&emu, data, size);
+        }
+    }
+
+    if (tb_init() < 0) {
+        printf("Couldn't initialize the terminal\n");
+        return 1;
+    }
+    tb_select_output_mode(TB_OUTPUT_NORMAL);
+    tb_set_cursor(TB_HIDE_CURSOR, TB_HIDE_CURSOR);
+    drawChrome();
+
+    bool      running  = true;
+    bool      infinite = false;
+    EmuStatus failure  = EMU_OK;
+    uint64_t  due      = now();
+
+    while (running) {
+        { // Input, until the next frame is due
+            struct tb_event event;
+            for (;;) {
+                int64_t waitMs = ((int64_t)(due - now())) / 1000000;
+                if (waitMs < 0) waitMs = 0;
+                int type = tb_peek_event(&event, (int)waitMs);
+                if (type <= 0) break;
+
+                if (type == TB_EVENT_RESIZE) {
+                    drawChrome();
+                }
+                else if (type == TB_EVENT_KEY) {
+                    if (event.key == TB_KEY_ESC || event.key == TB_KEY_CTRL_C) {
+                        running = false;
+                        break;
+                    }
+                    int index = getKeyIndex(event.ch);
+                    if (index != -1) {
+                        emu.key[index]   = 1;
+                        keyTimers[index] = holdFrames;
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < 16; i++) { // Key decay stands in for key-up
+            if (keyTimers[i] > 0 && --keyTimers[i] == 0) emu.key[i] = 0;
+        }
+
+        if (!infinite && running) { // run emulator
+            int ran;
+            EmuStatus status = Emulator_run(&emu, cyclesPerFrame, &ran);
+            if (status == EMU_HALTED) {
+                infinite = true;
+            } else if (status != EMU_OK) {
+                failure = status;
+                running = false;
+            }
+        }
+        Emulator_tickTimers(&emu);
+
+        if (emu.drawFlag || !shownValid) { // Update Graphics
+            emu.drawFlag = false;
+            if (drawScreen() > 0) tb_present();
+        }
+
+        due += FRAME_NS;
+        if ((int64_t)(now() - due) > 250000000L) due = now(); // stalled; don't race to catch up
+    }
+
+    tb_shutdown();
+    if (failure != EMU_OK) {
+        printf("%s: 0x%04X at 0x%04x\n", Emulator_statusName(failure), emu.opcode, emu.pc);
+    }
+    Emulator_free(&emu);
+    return failure != EMU_OK;
+}
@@ -0,0 +1,1598 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "asm.h"
+
+#define ROM_LOC       ASM_ROM_LOC
+#define MAX_ROM_SZ    ASM_MAX_ROM_SZ
+#define MAX_OPERANDS  3
+#define ARENA_CHUNK_SZ (64 * 1024)
+
+/**
+ * Bump allocator. Everything the assembler builds lives until the program
+ * is encoded, so nothing is freed individually; Arena_free releases it all.
+ */
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t             used;
+    size_t             size;
+    uint8_t            data[];
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk* head;
+    jmp_buf*    outOfMemory;
+} Arena;
+
+static void Arena_init(Arena* arena, jmp_buf* outOfMemory) {
+    arena->head = NULL;
+    arena->outOfMemory = outOfMemory;
+}
+
+static void* Arena_alloc(Arena* arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+
+    ArenaChunk* chunk = arena->head;
+    if (chunk == NULL || chunk->used + size > chunk->size) {
+        size_t chunkSize = size > ARENA_CHUNK_SZ ? size : ARENA_CHUNK_SZ;
+        chunk = malloc(sizeof(ArenaChunk) + chunkSize);
+        if (chunk == NULL) longjmp(*arena->outOfMemory, 1);
+        chunk->next = arena->head;
+        chunk->used = 0;
+        chunk->size = chunkSize;
+        arena->head = chunk;
+    }
+
+    void* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+static void Arena_free(Arena* arena) {
+    ArenaChunk* chunk = arena->head;
+    while (chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+}
+
+/**
+ * A token: a pointer into the mapped source plus a length. Nothing is
+ * copied out of the source buffer.
+ */
+typedef struct {
+    const char* chars;
+    uint32_t    len;
+} StrView;
+
+static bool StrView_equals(StrView view, const char* s) {
+    return strlen(s) == view.len && memcmp(view.chars, s, view.len) == 0;
+}
+
+typedef struct {
+    StrView  name;
+    uint32_t hash;
+    int32_t  instr; // index of the instruction the label points at, -1 if undefined
+    uint16_t addr;  // set by layout()
+} Symbol;
+
+/**
+ * Open-addressing hash table of labels. Slots hold indices into symbols, so
+ * operands can refer to a label before it is defined and the table can
+ * grow without invalidating those references.
+ */
+typedef struct {
+    Symbol*   symbols;
+    uint32_t  count;
+    uint32_t  symbolCapacity;
+    uint32_t* slots; // symbol index + 1, 0 marks a free slot
+    uint32_t  capacity; // always a power of two
+} SymbolTable;
+
+static uint32_t hashName(StrView name) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (uint32_t i = 0; i < name.len; i++) {
+        hash ^= (uint8_t)name.chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void SymbolTable_init(SymbolTable* table, Arena* arena, uint32_t capacity) {
+    table->count          = 0;
+    table->symbolCapacity = capacity / 2;
+    table->symbols        = Arena_alloc(arena, table->symbolCapacity * sizeof(Symbol));
+    table->capacity       = capacity;
+    table->slots          = Arena_alloc(arena, capacity * sizeof(uint32_t));
+    memset(table->slots, 0, capacity * sizeof(uint32_t));
+}
+
+static uint32_t* SymbolTable_slot(SymbolTable* table, StrView name, uint32_t hash) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t i    = hash & mask;
+    while (table->slots[i] != 0) {
+        Symbol* s = &table->symbols[table->slots[i] - 1];
+        if (s->hash == hash && s->name.len == name.len &&
+                memcmp(s->name.chars, name.chars, name.len) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+static void SymbolTable_grow(SymbolTable* table, Arena* arena) {
+    Symbol*  oldSymbols = table->symbols;
+    uint32_t count      = table->count;
+
+    SymbolTable_init(table, arena, table->capacity * 2);
+    memcpy(table->symbols, oldSymbols, count * sizeof(Symbol));
+    for (uint32_t i = 0; i < count; i++) {
+        *SymbolTable_slot(table, oldSymbols[i].name, oldSymbols[i].hash) = i + 1;
+    }
+    table->count = count;
+}
+
+/**
+ * Returns the index of the symbol called name, adding it (undefined) if
+ * this is the first time it has been seen.
+ */
+static uint32_t SymbolTable_intern(SymbolTable* table, Arena* arena, StrView name) {
+    uint32_t  hash = hashName(name);
+    uint32_t* slot = SymbolTable_slot(table, name, hash);
+    if (*slot != 0) return *slot - 1;
+
+    if (table->count == table->symbolCapacity) {
+        SymbolTable_grow(table, arena);
+        slot = SymbolTable_slot(table, name, hash);
+    }
+
+    Symbol* s = &table->symbols[table->count];
+    s->name  = name;
+    s->hash  = hash;
+    s->instr = -1;
+    s->addr  = 0;
+    *slot = ++table->count;
+    return table->count - 1;
+}
+
+typedef enum {
+    MNEMONIC_UNKNOWN,
+    MNEMONIC_CLS,
+    MNEMONIC_RET,
+    MNEMONIC_JP,
+    MNEMONIC_LD,
+    MNEMONIC_RND,
+    MNEMONIC_SE,
+    MNEMONIC_DRW,
+    MNEMONIC_ADD,
+    MNEMONIC_BYTE,
+    MNEMONIC_DATA,
+    MNEMONIC_INCLUDE
+} Mnemonic;
+
+static const char* MNEMONIC_NAMES[] = {
+    "???", "CLS", "RET", "JP", "LD", "RND", "SE", "DRW", "ADD", "BYTE", "DATA", "INCLUDE"
+};
+
+/**
+ * Maps a mnemonic to its enum by switching on its first character, so each
+ * lookup costs at most one or two string compares.
+ */
+static Mnemonic getMnemonic(StrView s) {
+    switch (s.chars[0]) {
+        case 'A': if (StrView_equals(s, "ADD"))  return MNEMONIC_ADD;  break;
+        case 'B': if (StrView_equals(s, "BYTE")) return MNEMONIC_BYTE; break;
+        case 'C': if (StrView_equals(s, "CLS"))  return MNEMONIC_CLS;  break;
+        case 'D':
+            if (StrView_equals(s, "DRW"))  return MNEMONIC_DRW;
+            if (StrView_equals(s, "DATA")) return MNEMONIC_DATA;
+            break;
+        case 'I': if (StrView_equals(s, "INCLUDE")) return MNEMONIC_INCLUDE; break;
+        case 'J': if (StrView_equals(s, "JP"))   return MNEMONIC_JP;   break;
+        case 'L': if (StrView_equals(s, "LD"))   return MNEMONIC_LD;   break;
+        case 'R':
+            if (StrView_equals(s, "RET")) return MNEMONIC_RET;
+            if (StrView_equals(s, "RND")) return MNEMONIC_RND;
+            break;
+        case 'S': if (StrView_equals(s, "SE"))   return MNEMONIC_SE;   break;
+    }
+    return MNEMONIC_UNKNOWN;
+}
+
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_LITERAL,
+    OPERAND_REGISTER,
+    OPERAND_LABEL,
+    OPERAND_I,
+    OPERAND_I_MEM, // [I]
+    OPERAND_PATH
+} OperandType;
+
+typedef struct {
+    uint8_t  type;  // OperandType
+    uint16_t value; // literal value, register index, symbol index or include index
+} Operand;
+
+typedef struct {
+    uint8_t  mnemonic; // Mnemonic
+    uint8_t  opCount;
+    uint32_t line;
+    Operand  ops[MAX_OPERANDS];
+} Instruction;
+
+typedef struct {
+    Arena        arena;
+    SymbolTable  labels;
+    Instruction* instrs;
+    uint32_t     count;
+    uint32_t     capacity;
+    StrView*     includes; // INCLUDE paths, as pointers into the source
+    uint32_t     includeCount;
+    uint32_t     includeCapacity;
+    bool         relocatable; // label operands become relocations instead of addresses
+    uint16_t     origin;      // address of the first instruction
+    AsmReloc*    relocs;
+    uint32_t     relocCount;
+    AsmRom*      rom;
+    FILE*        listing;
+    jmp_buf      fail; // every error unwinds straight back to Asm_assemble
+} Program;
+
+static void Program_init(Program* program, AsmRom* rom, FILE* listing) {
+    Arena_init(&program->arena, &program->fail);
+    program->rom     = rom;
+    program->listing = listing;
+    SymbolTable_init(&program->labels, &program->arena, 256);
+    program->count    = 0;
+    program->capacity = 1024;
+    program->instrs   = Arena_alloc(&program->arena, program->capacity * sizeof(Instruction));
+    program->includeCount    = 0;
+    program->includeCapacity = 0;
+    program->includes        = NULL;
+    program->relocatable     = false;
+    program->origin          = ROM_LOC;
+    program->relocs          = NULL;
+    program->relocCount      = 0;
+}
+
+static Instruction* Program_append(Program* program) {
+    if (program->count == program->capacity) {
+        Instruction* old = program->instrs;
+        program->capacity *= 2;
+        program->instrs = Arena_alloc(&program->arena, program->capacity * sizeof(Instruction));
+        memcpy(program->instrs, old, program->count * sizeof(Instruction));
+    }
+    Instruction* instr = &program->instrs[program->count++];
+    memset(instr, 0, sizeof(Instruction));
+    return instr;
+}
+
+static void Program_free(Program* program) {
+    Arena_free(&program->arena);
+}
+
+static uint16_t Instruction_size(Instruction* instr) {
+    switch (instr->mnemonic) {
+        case MNEMONIC_BYTE:    return 1;
+        case MNEMONIC_INCLUDE: return 0; // the included code is placed by the linker
+        default:               return 2;
+    }
+}
+
+static bool isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool isNewline(char c) {
+    return c == '\n';
+}
+
+static bool isWordchar(char c) {
+    return (c >= '0' && c <= '9') ||
+           (c >= 'A' && c <= 'Z') ||
+           (c >= 'a' && c <= 'z');
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * Parses a decimal, 0x hexadecimal or 0b binary literal. Returns false if
+ * the token is not a number.
+ */
+static bool parseLiteral(StrView tok, uint32_t* value) {
+    uint32_t base  = 10;
+    uint32_t start = 0;
+    if (tok.len > 2 && tok.chars[0] == '0' && (tok.chars[1] == 'x' || tok.chars[1] == 'b')) {
+        base  = tok.chars[1] == 'x' ? 16 : 2;
+        start = 2;
+    }
+
+    uint32_t v = 0;
+    for (uint32_t i = start; i < tok.len; i++) {
+        char     c = tok.chars[i];
+        uint32_t d;
+        if (c >= '0' && c <= '9')      d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else return false;
+        if (d >= base) return false;
+        v = v * base + d;
+    }
+    *value = v;
+    return true;
+}
+
+static void fail(Program* program, uint32_t line, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(program->rom->error, sizeof(program->rom->error), format, args);
+    va_end(args);
+
+    program->rom->errorLine = line;
+    longjmp(program->fail, 1);
+}
+
+static void parseError(Program* program, uint32_t line, const char* message, StrView tok) {
+    fail(program, line, "%s \"%.*s\"", message, (int)tok.len, tok.chars);
+}
+
+static Operand parseOperand(Program* program, StrView tok, uint32_t line) {
+    Operand op;
+    uint32_t value;
+
+    if (isDigit(tok.chars[0])) {
+        if (!parseLiteral(tok, &value)) parseError(program, line, "Invalid literal", tok);
+        op.type  = OPERAND_LITERAL;
+        op.value = value;
+    } else if (tok.len == 1 && tok.chars[0] == 'I') {
+        op.type  = OPERAND_I;
+        op.value = 0;
+    } else if (tok.chars[0] == 'V' && tok.len == 2 && parseLiteral((StrView){ tok.chars + 1, 1 }, &value)) {
+        op.type  = OPERAND_REGISTER;
+        op.value = value;
+    } else if (tok.chars[0] == 'V' && tok.len == 3 && isDigit(tok.chars[1]) && isDigit(tok.chars[2])) {
+        op.type  = OPERAND_REGISTER;
+        op.value = (tok.chars[1] - '0') * 10 + (tok.chars[2] - '0');
+        if (op.value > 0xF) parseError(program, line, "Invalid register", tok);
+    } else {
+        uint32_t index = SymbolTable_intern(&program->labels, &program->arena, tok);
+        if (index > 0xFFFF) parseError(program, line, "Too many labels at", tok);
+        op.type  = OPERAND_LABEL;
+        op.value = index;
+    }
+
+    return op;
+}
+
+/**
+ * Reads the quoted path after INCLUDE into the program's include list and
+ * returns the position after the closing quote.
+ */
+static size_t parseInclude(Program* program, Instruction* instr, const char* source, size_t size, size_t pos) {
+    while (pos < size && isWhitespace(source[pos])) {
+        pos++;
+    }
+    if (pos == size || source[pos] != '"') fail(program, instr->line, "INCLUDE requires a quoted path");
+
+    size_t end = ++pos;
+    while (end < size && source[end] != '"' && !isNewline(source[end])) {
+        end++;
+    }
+    if (end == size || source[end] != '"') fail(program, instr->line, "Unterminated INCLUDE path");
+    if (end == pos) fail(program, instr->line, "Empty INCLUDE path");
+
+    if (program->includeCount == program->includeCapacity) {
+        StrView* old = program->includes;
+        program->includeCapacity = program->includeCapacity ? program->includeCapacity * 2 : 16;
+        program->includes = Arena_alloc(&program->arena, program->includeCapacity * sizeof(StrView));
+        if (old) memcpy(program->includes, old, program->includeCount * sizeof(StrView));
+    }
+    if (program->includeCount > 0xFFFF) fail(program, instr->line, "Too many INCLUDEs");
+
+    program->includes[program->includeCount] = (StrView){ source + pos, end - pos };
+    instr->ops[0].type  = OPERAND_PATH;
+    instr->ops[0].value = program->includeCount++;
+    instr->opCount = 1;
+    return end + 1;
+}
+
+/**
+ * Tokenizes the whole source in one pass, straight into the IR. Labels are
+ * bound to the index of the instruction that follows them; addresses are
+ * assigned later, once the program is final.
+ */
+static void parse(Program* program, const char* source, size_t size) {
+    size_t       start = 0;
+    uint32_t     line  = 1;
+    Instruction* instr = NULL;
+
+    while (start < size) {
+        char c = source[start];
+        if (isWhitespace(c) || c == ',') {
+            start++;
+        }
+        else if (isNewline(c)) {
+            instr = NULL;
+            line++;
+            start++;
+        }
+        else if (c == ';') {
+            while (start < size && source[start] != '\n') {
+                start++;
+            }
+        }
+        else if (isWordchar(c)) {
+            size_t end = start;
+            while (end < size && isWordchar(source[end])) {
+                end++;
+            }
+            StrView tok = { source + start, end - start };
+
+            if (end < size && source[end] == ':') {
+                uint32_t index = SymbolTable_intern(&program->labels, &program->arena, tok);
+                Symbol*  label = &program->labels.symbols[index];
+                if (label->instr >= 0) parseError(program, line, "Duplicate label", tok);
+                label->instr = program->count;
+                end++;
+            }
+            else if (instr == NULL) {
+                Mnemonic m = getMnemonic(tok);
+                if (m == MNEMONIC_UNKNOWN) parseError(program, line, "Unknown instruction", tok);
+                instr = Program_append(program);
+                instr->mnemonic = m;
+                instr->line     = line;
+                if (m == MNEMONIC_INCLUDE) end = parseInclude(program, instr, source, size, end);
+            }
+            else {
+                if (instr->opCount == MAX_OPERANDS) parseError(program, line, "Too many operands at", tok);
+                instr->ops[instr->opCount++] = parseOperand(program, tok, line);
+            }
+            start = end;
+        }
+        else if (c == '[' && instr != NULL) {
+            if (start + 3 > size || source[start + 1] != 'I' || source[start + 2] != ']') {
+                fail(program, line, "Expected [I]");
+            }
+            if (instr->opCount == MAX_OPERANDS) fail(program, line, "Too many operands at [I]");
+            instr->ops[instr->opCount].type  = OPERAND_I_MEM;
+            instr->ops[instr->opCount].value = 0;
+            instr->opCount++;
+            start += 3;
+        }
+        else {
+            fail(program, line, "Invalid character %c", c);
+        }
+    }
+}
+
+/**
+ * Assigns an address to every label from the sizes of the instructions
+ * before it. Must be rerun whenever instructions are added or removed.
+ */
+static void layout(Program* program) {
+    uint16_t* offsets = Arena_alloc(&program->arena, (program->count + 1) * sizeof(uint16_t));
+    uint32_t  offset  = program->origin;
+    for (uint32_t i = 0; i < program->count; i++) {
+        offsets[i] = offset;
+        offset += Instruction_size(&program->instrs[i]);
+    }
+    offsets[program->count] = offset;
+
+    for (uint32_t i = 0; i < program->labels.count; i++) {
+        Symbol* s = &program->labels.symbols[i];
+        if (s->instr >= 0) s->addr = offsets[s->instr];
+    }
+}
+
+/**
+ * Called just before the instruction using op is appended. In relocatable
+ * mode the label may live in another file, so a relocation against the
+ * instruction's offset is recorded and the address is left as zero.
+ */
+static uint16_t getLabelAddress(Program* program, Operand* op, uint32_t line) {
+    if (program->relocatable) {
+        AsmReloc* reloc = &program->relocs[program->relocCount++];
+        reloc->offset = program->rom->size;
+        reloc->symbol = op->value;
+        reloc->line   = line;
+        return 0;
+    }
+    Symbol* s = &program->labels.symbols[op->value];
+    if (s->instr < 0) parseError(program, line, "Unknown identifier", s->name);
+    return s->addr;
+}
+
+static bool isRegisterImmediate(Instruction* instr, Mnemonic mnemonic) {
+    return instr->mnemonic == mnemonic && instr->opCount == 2 &&
+           instr->ops[0].type == OPERAND_REGISTER && instr->ops[1].type == OPERAND_LITERAL;
+}
+
+static bool isLoadFromMemory(Instruction* instr) {
+    return instr->mnemonic == MNEMONIC_LD && instr->opCount == 2 &&
+           instr->ops[0].type == OPERAND_REGISTER && instr->ops[1].type == OPERAND_I_MEM;
+}
+
+/**
+ * Returns the index of the JP's label if it is defined in this program,
+ * -1 otherwise.
+ */
+static int32_t jumpTarget(Program* program, Instruction* instr) {
+    if (instr->mnemonic != MNEMONIC_JP || instr->opCount != 1 || instr->ops[0].type != OPERAND_LABEL) return -1;
+    return program->labels.symbols[instr->ops[0].value].instr >= 0 ? instr->ops[0].value : -1;
+}
+
+/**
+ * True if the instruction before this one might skip it: SE, or anything
+ * whose encoding we can't see (raw DATA and BYTE, or the last instruction
+ * of an included file). Removing or merging an instruction there would
+ * make the skip land somewhere else.
+ */
+static bool mayBeSkipped(Program* program, bool* removed, uint32_t i) {
+    while (i > 0 && removed[i - 1]) {
+        i--;
+    }
+    if (i == 0) return program->relocatable; // another file's code may come first
+    switch (program->instrs[i - 1].mnemonic) {
+        case MNEMONIC_SE:
+        case MNEMONIC_DATA:
+        case MNEMONIC_BYTE:
+        case MNEMONIC_INCLUDE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Removes the instructions marked in removed. Labels bound to a removed
+ * instruction move to the next one that is kept.
+ */
+static uint32_t compact(Program* program, bool* removed) {
+    uint32_t* newIndex = Arena_alloc(&program->arena, (program->count + 1) * sizeof(uint32_t));
+    uint32_t  kept     = 0;
+    for (uint32_t i = 0; i < program->count; i++) {
+        newIndex[i] = kept;
+        if (!removed[i]) program->instrs[kept++] = program->instrs[i];
+    }
+    newIndex[program->count] = kept;
+
+    for (uint32_t i = 0; i < program->labels.count; i++) {
+        Symbol* s = &program->labels.symbols[i];
+        if (s->instr >= 0) s->instr = newIndex[s->instr];
+    }
+
+    uint32_t removedCount = program->count - kept;
+    program->count = kept;
+    return removedCount;
+}
+
+/**
+ * Peephole pass over the IR, repeated until nothing changes:
+ *  - JP to the next instruction is removed
+ *  - consecutive ADD Vx, kk are merged (7xkk leaves VF alone)
+ *  - JP to a JP goes straight to the final target
+ *  - LD/ADD Vn, kk right before LD Vx, [I] with n <= x are dropped,
+ *    looking back past LD I and stores to higher registers
+ * Labels stay bound to instructions, so layout() must run afterwards.
+ */
+static void optimize(Program* program) {
+    uint32_t removedTotal = 0;
+    uint32_t threaded     = 0;
+    bool     changed      = true;
+
+    while (changed) {
+        changed = false;
+
+        bool* isTarget = Arena_alloc(&program->arena, program->count + 1);
+        bool* removed  = Arena_alloc(&program->arena, program->count + 1);
+        memset(isTarget, 0, program->count + 1);
+        memset(removed, 0, program->count + 1);
+        for (uint32_t i = 0; i < program->labels.count; i++) {
+            Symbol* s = &program->labels.symbols[i];
+            if (s->instr >= 0) isTarget[s->instr] = true;
+        }
+
+        for (uint32_t i = 0; i < program->count; i++) {
+            Instruction* instr = &program->instrs[i];
+            if (removed[i]) continue;
+
+            int32_t target = jumpTarget(program, instr);
+            if (target >= 0) {
+                // Follow JP chains; give up on cycles rather than chase them
+                int32_t final = target;
+                int     hops  = 0;
+                while (hops < 64) {
+                    Symbol* s    = &program->labels.symbols[final];
+                    int32_t next = s->instr < (int32_t)program->count ? jumpTarget(program, &program->instrs[s->instr]) : -1;
+                    if (next < 0 || next == final) break;
+                    final = next;
+                    hops++;
+                }
+                if (hops > 0 && hops < 64) {
+                    instr->ops[0].value = final;
+                    target = final;
+                    threaded++;
+                    changed = true;
+                }
+
+                if (program->labels.symbols[target].instr == (int32_t)i + 1 && !mayBeSkipped(program, removed, i)) {
+                    removed[i] = true;
+                    changed = true;
+                }
+            }
+            else if (isRegisterImmediate(instr, MNEMONIC_ADD) && i + 1 < program->count) {
+                Instruction* next = &program->instrs[i + 1];
+                if (isRegisterImmediate(next, MNEMONIC_ADD) && next->ops[0].value == instr->ops[0].value &&
+                        !isTarget[i + 1] && !mayBeSkipped(program, removed, i)) {
+                    instr->ops[1].value = (instr->ops[1].value + next->ops[1].value) & 0xFF;
+                    removed[i + 1] = true;
+                    if (instr->ops[1].value == 0) removed[i] = true;
+                    changed = true;
+                }
+            }
+            else if (isLoadFromMemory(instr)) {
+                uint16_t x = instr->ops[0].value;
+                for (int32_t j = (int32_t)i - 1; j >= 0; j--) {
+                    Instruction* prev = &program->instrs[j];
+                    if (removed[j]) continue;
+                    bool setsI = prev->mnemonic == MNEMONIC_LD && prev->ops[0].type == OPERAND_I;
+                    if (setsI) continue; // reads no V register
+                    if (!isRegisterImmediate(prev, MNEMONIC_LD) && !isRegisterImmediate(prev, MNEMONIC_ADD)) break;
+                    if (prev->ops[0].value <= x && !mayBeSkipped(program, removed, j)) {
+                        removed[j] = true;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        removedTotal += compact(program, removed);
+    }
+
+    if (program->listing) {
+        fprintf(program->listing, "Optimizer: removed %u instructions, threaded %u jumps\n", removedTotal, threaded);
+    }
+}
+
+static void printOperand(Program* program, Operand* op) {
+    FILE* out = program->listing;
+    switch (op->type) {
+        case OPERAND_LITERAL:  fprintf(out, " %d", op->value); break;
+        case OPERAND_REGISTER: fprintf(out, " V%d", op->value); break;
+        case OPERAND_I:        fprintf(out, " I"); break;
+        case OPERAND_I_MEM:    fprintf(out, " [I]"); break;
+        case OPERAND_PATH: {
+            StrView path = program->includes[op->value];
+            fprintf(out, " \"%.*s\"", (int)path.len, path.chars);
+        }
+        break;
+        case OPERAND_LABEL: {
+            StrView name = program->labels.symbols[op->value].name;
+            fprintf(out, " %.*s", (int)name.len, name.chars);
+        }
+        break;
+    }
+}
+
+static void Rom_appendInstruction(Program* program, uint16_t instruction) {
+    AsmRom* rom = program->rom;
+    if (program->listing) {
+        fprintf(program->listing, "0x%04zX (%zu): 0x%04X\n", rom->size, rom->size, instruction);
+    }
+    if (rom->size + 2 > MAX_ROM_SZ) fail(program, 0, "Program too large");
+    rom->bytes[rom->size]     = instruction >> 8;
+    rom->bytes[rom->size + 1] = instruction & 0xFF;
+    rom->size += 2;
+}
+
+static void Rom_appendByte(Program* program, uint8_t byte) {
+    AsmRom* rom = program->rom;
+    if (program->listing) {
+        fprintf(program->listing, "0x%04zX (%zu): 0x%04X\n", rom->size, rom->size, byte);
+    }
+    if (rom->size + 1 > MAX_ROM_SZ) fail(program, 0, "Program too large");
+    rom->bytes[rom->size] = byte;
+    rom->size += 1;
+}
+
+static void Rom_dump(AsmRom* rom, FILE* out) {
+    fprintf(out, "Byte count: %zu\n", rom->size);
+    for (size_t i = 0; i < rom->size; i++) {
+        if (i % 32 == 0) fprintf(out, "0x%04zX: ", ROM_LOC + i);
+        fprintf(out, "%02X", rom->bytes[i]);
+        if (i % 2 == 1) fprintf(out, " ");
+        if ((i+1) % 32 == 0) fprintf(out, "\n");
+    }
+    fprintf(out, "\n");
+}
+
+static void typeError(Program* program, Instruction* instr, const char* message) {
+    fail(program, instr->line, "%s", message);
+}
+
+static void encode(Program* program) {
+    for (uint32_t i = 0; i < program->count; ++i) {
+        Instruction* instr = &program->instrs[i];
+        OperandType  t1    = instr->opCount > 0 ? instr->ops[0].type : OPERAND_NONE;
+        OperandType  t2    = instr->opCount > 1 ? instr->ops[1].type : OPERAND_NONE;
+        OperandType  t3    = instr->opCount > 2 ? instr->ops[2].type : OPERAND_NONE;
+        uint16_t     op;
+
+        if (program->listing) fprintf(program->listing, "[%u] ", i);
+
+        switch (instr->mnemonic) {
+            case MNEMONIC_CLS: {
+                op = 0x00E0;
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_RET: {
+                op = 0x00EE;
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_JP: {
+                op = 0x1000;
+                if (t1 == OPERAND_LABEL) {
+                    op |= (getLabelAddress(program, &instr->ops[0], instr->line) & 0xFFF);
+                } else {
+                    typeError(program, instr, "Nope! Jump needs a label");
+                }
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_LD: {
+                if (t1 == OPERAND_REGISTER && t2 == OPERAND_LITERAL) {
+                    op = 0x6000;
+                    op |= (instr->ops[0].value & 0xF) << 8;
+                    op |= (instr->ops[1].value & 0xFF);
+                }
+                else if (t1 == OPERAND_I && t2 == OPERAND_LABEL) {
+                    op = 0xA000;
+                    op |= (getLabelAddress(program, &instr->ops[1], instr->line) & 0xFFF);
+                }
+                else if (t1 == OPERAND_REGISTER && t2 == OPERAND_I_MEM) {
+                    op = 0xF065;
+                    op |= (instr->ops[0].value & 0xF) << 8;
+                }
+                else if (t1 == OPERAND_I_MEM && t2 == OPERAND_REGISTER) {
+                    op = 0xF055;
+                    op |= (instr->ops[1].value & 0xF) << 8;
+                }
+                else {
+                    typeError(program, instr, "LD requires a register and a literal, I and a label, or a register and [I]");
+                }
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_RND: {
+                if (t1 == OPERAND_REGISTER && t2 == OPERAND_LITERAL) {
+                    op = 0xC000;
+                    op |= (instr->ops[0].value & 0xF) << 8;
+                    op |= (instr->ops[1].value & 0xFF);
+                }
+                else {
+                    typeError(program, instr, "RND requires register and literal");
+                }
+
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_SE: {
+                if (t1 == OPERAND_REGISTER && t2 == OPERAND_LITERAL) {
+                    op = 0x3000;
+                    op |= (instr->ops[0].value & 0xF) << 8;
+                    op |= (instr->ops[1].value & 0xFF);
+                }
+                else if (t1 == OPERAND_REGISTER && t2 == OPERAND_REGISTER) {
+                    op = 0x5000;
+                    op |= (instr->ops[0].value & 0xF) << 8;
+                    op |= (instr->ops[1].value & 0xF) << 4;
+                }
+                else {
+                    typeError(program, instr, "SE requires two register operands or register and literal");
+                }
+
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_DRW: {
+                if (t1 == OPERAND_REGISTER && t2 == OPERAND_REGISTER && t3 == OPERAND_LITERAL) {
+                    op = 0xD000;
+                    op |= (instr->ops[0].value & 0xF) << 8;
+                    op |= (instr->ops[1].value & 0xF) << 4;
+                    op |= (instr->ops[2].value & 0xF);
+                }
+                else {
+                    typeError(program, instr, "DRW requires two register operands and a literal");
+                }
+
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_ADD: {
+                if (t1 == OPERAND_REGISTER && t2 == OPERAND_LITERAL) {
+                    op = 0x7000;
+                    op |= (instr->ops[0].value & 0xF) << 8;
+                    op |= (instr->ops[1].value & 0xFF);
+                }
+                else {
+                    typeError(program, instr, "ADD requires a register and a literal operand");
+                }
+
+                Rom_appendInstruction(program, op);
+            }
+            break;
+
+            case MNEMONIC_BYTE: {
+                if (t1 != OPERAND_LITERAL) typeError(program, instr, "BYTE requires a literal");
+                Rom_appendByte(program, instr->ops[0].value & 0xFF);
+            }
+            break;
+
+            case MNEMONIC_DATA: {
+                if (t1 != OPERAND_LITERAL) typeError(program, instr, "DATA requires a literal");
+                Rom_appendInstruction(program, instr->ops[0].value & 0xFFFF);
+            }
+            break;
+
+            case MNEMONIC_INCLUDE: {
+                if (!program->relocatable) typeError(program, instr, "INCLUDE needs a file build (Asm_build)");
+                if (program->listing) fprintf(program->listing, "0x%04zX (%zu): INCLUDE\n", program->rom->size, program->rom->size);
+            }
+            break;
+
+            default:
+                typeError(program, instr, "Unknown instruction");
+        }
+    }
+}
+
+static void printProgram(Program* program) {
+    FILE* out = program->listing;
+
+    fputs("===\n", out);
+    for (uint32_t i = 0; i < program->count; ++i) {
+        Instruction* instr = &program->instrs[i];
+
+        fprintf(out, "[%u] ", i);
+        fprintf(out, "%s", MNEMONIC_NAMES[instr->mnemonic]);
+
+        for (int j = 0; j < instr->opCount; ++j) {
+            printOperand(program, &instr->ops[j]);
+        }
+
+        fprintf(out, "\n");
+    }
+
+    fputs("===\n", out);
+    for (uint32_t i = 0; i < program->labels.count; ++i) {
+        Symbol* l = &program->labels.symbols[i];
+        if (l->instr < 0) continue;
+        fprintf(out, "Label: %.*s (0x%04X)\n", (int)l->name.len, l->name.chars, l->addr);
+    }
+    fputs("===\n", out);
+}
+
+bool Asm_assemble(const char* source, size_t length, const AsmOptions* options, AsmRom* rom) {
+    rom->size         = 0;
+    rom->errorLine    = 0;
+    rom->errorFile[0] = '\0';
+    rom->error[0]     = '\0';
+
+    // Only what has to survive the longjmp lives outside the setjmp frame
+    Program* program = malloc(sizeof(Program));
+    if (program == NULL) {
+        snprintf(rom->error, sizeof(rom->error), "Out of memory");
+        return false;
+    }
+
+    bool ok = false;
+    program->arena.head = NULL;
+    if (setjmp(program->fail) == 0) {
+        Program_init(program, rom, options ? options->listing : NULL);
+        parse(program, source, length);
+        if (options && options->optimize) optimize(program);
+        layout(program);
+        if (program->listing) printProgram(program);
+        encode(program);
+        if (program->listing) Rom_dump(rom, program->listing);
+        ok = true;
+    } else if (rom->error[0] == '\0') {
+        snprintf(rom->error, sizeof(rom->error), "Out of memory");
+    }
+
+    Program_free(program);
+    free(program);
+    if (!ok) rom->size = 0;
+    return ok;
+}
+
+static char* copyString(Program* program, const char* chars, size_t len) {
+    char* copy = malloc(len + 1);
+    if (copy == NULL) longjmp(program->fail, 1);
+    memcpy(copy, chars, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/**
+ * Moves the encoded bytes, labels, relocations and include points of a
+ * relocatable program into object. Labels keep their symbol index so the
+ * relocations can refer to them directly.
+ */
+static void exportObject(Program* program, AsmObject* object) {
+    // Own offset and number of preceding INCLUDEs for every instruction
+    uint16_t* offsets  = Arena_alloc(&program->arena, (program->count + 1) * sizeof(uint16_t));
+    uint16_t* segments = Arena_alloc(&program->arena, (program->count + 1) * sizeof(uint16_t));
+    uint32_t  offset   = 0;
+    uint32_t  segment  = 0;
+    for (uint32_t i = 0; i < program->count; i++) {
+        offsets[i]  = offset;
+        segments[i] = segment;
+        offset += Instruction_size(&program->instrs[i]);
+        if (program->instrs[i].mnemonic == MNEMONIC_INCLUDE) segment++;
+    }
+    offsets[program->count]  = offset;
+    segments[program->count] = segment;
+
+    object->bytes = malloc(program->rom->size > 0 ? program->rom->size : 1);
+    if (object->bytes == NULL) longjmp(program->fail, 1);
+    memcpy(object->bytes, program->rom->bytes, program->rom->size);
+    object->size = program->rom->size;
+
+    object->symbols = calloc(program->labels.count + 1, sizeof(AsmSymbol));
+    if (object->symbols == NULL) longjmp(program->fail, 1);
+    object->symbolCount = program->labels.count;
+    for (uint32_t i = 0; i < program->labels.count; i++) {
+        Symbol*    s   = &program->labels.symbols[i];
+        AsmSymbol* out = &object->symbols[i];
+        out->name    = copyString(program, s->name.chars, s->name.len);
+        out->defined = s->instr >= 0;
+        if (out->defined) {
+            out->segment = segments[s->instr];
+            out->offset  = offsets[s->instr];
+        }
+    }
+
+    object->relocs = malloc((program->relocCount + 1) * sizeof(AsmReloc));
+    if (object->relocs == NULL) longjmp(program->fail, 1);
+    memcpy(object->relocs, program->relocs, program->relocCount * sizeof(AsmReloc));
+    object->relocCount = program->relocCount;
+
+    object->includes = calloc(program->includeCount + 1, sizeof(AsmInclude));
+    if (object->includes == NULL) longjmp(program->fail, 1);
+    object->includeCount = program->includeCount;
+    for (uint32_t i = 0; i < program->count; i++) {
+        Instruction* instr = &program->instrs[i];
+        if (instr->mnemonic != MNEMONIC_INCLUDE) continue;
+
+        StrView     path = program->includes[instr->ops[0].value];
+        AsmInclude* out  = &object->includes[instr->ops[0].value];
+        out->offset = offsets[i];
+        out->line   = instr->line;
+        out->path   = copyString(program, path.chars, path.len);
+    }
+}
+
+bool Asm_compile(const char* source, size_t length, const AsmOptions* options, AsmObject* object) {
+    memset(object, 0, sizeof(AsmObject));
+
+    AsmRom*  rom     = malloc(sizeof(AsmRom));
+    Program* program = malloc(sizeof(Program));
+    if (rom == NULL || program == NULL) {
+        free(rom);
+        free(program);
+        snprintf(object->error, sizeof(object->error), "Out of memory");
+        return false;
+    }
+    rom->size      = 0;
+    rom->errorLine = 0;
+    rom->error[0]  = '\0';
+
+    bool ok = false;
+    program->arena.head = NULL;
+    if (setjmp(program->fail) == 0) {
+        Program_init(program, rom, options ? options->listing : NULL);
+        program->relocatable = true;
+        program->origin      = 0;
+        parse(program, source, length);
+        if (options && options->optimize) optimize(program);
+        layout(program);
+        program->relocs = Arena_alloc(&program->arena, (program->count + 1) * sizeof(AsmReloc));
+        if (program->listing) {
+            fputs("Object code: offsets from the start of this file, label operands 0 until linked\n",
+                  program->listing);
+            printProgram(program);
+        }
+        encode(program);
+        exportObject(program, object);
+        ok = true;
+    } else if (rom->error[0] == '\0') {
+        snprintf(rom->error, sizeof(rom->error), "Out of memory");
+    }
+
+    if (!ok) {
+        AsmObject_free(object);
+        object->errorLine = rom->errorLine;
+        memcpy(object->error, rom->error, sizeof(object->error));
+    }
+
+    Program_free(program);
+    free(program);
+    free(rom);
+    return ok;
+}
+
+void AsmObject_free(AsmObject* object) {
+    for (uint32_t i = 0; object->symbols && i < object->symbolCount; i++) {
+        free(object->symbols[i].name);
+    }
+    for (uint32_t i = 0; object->includes && i < object->includeCount; i++) {
+        free(object->includes[i].path);
+    }
+    free(object->bytes);
+    free(object->symbols);
+    free(object->relocs);
+    free(object->includes);
+    object->bytes        = NULL;
+    object->symbols      = NULL;
+    object->relocs       = NULL;
+    object->includes     = NULL;
+    object->size         = 0;
+    object->symbolCount  = 0;
+    object->relocCount   = 0;
+    object->includeCount = 0;
+}
+
+// Object files are little-endian:
+//   "C8OB" u16 version, u16 size, u32 symbolCount, u32 relocCount, u32 includeCount
+//   u8 bytes[size]
+//   symbols:  u8 defined, u16 segment, u16 offset, u16 nameLength, name
+//   relocs:   u16 offset, u32 symbol, u32 line
+//   includes: u16 offset, u32 line, u16 pathLength, path
+static void putU16(FILE* out, uint16_t v) {
+    fputc(v & 0xFF, out);
+    fputc(v >> 8, out);
+}
+
+static void putU32(FILE* out, uint32_t v) {
+    putU16(out, v & 0xFFFF);
+    putU16(out, v >> 16);
+}
+
+static void putString(FILE* out, const char* s) {
+    size_t len = strlen(s);
+    putU16(out, len);
+    fwrite(s, 1, len, out);
+}
+
+bool AsmObject_write(const AsmObject* object, const char* path) {
+    // Written under a temporary name so a reader never sees half an object
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+    FILE* out = fopen(tmpPath, "wb");
+    if (out == NULL) return false;
+
+    fwrite("C8OB", 1, 4, out);
+    putU16(out, ASM_OBJECT_VERSION);
+    putU16(out, object->size);
+    putU32(out, object->symbolCount);
+    putU32(out, object->relocCount);
+    putU32(out, object->includeCount);
+    fwrite(object->bytes, 1, object->size, out);
+
+    for (uint32_t i = 0; i < object->symbolCount; i++) {
+        AsmSymbol* s = &object->symbols[i];
+        fputc(s->defined, out);
+        putU16(out, s->segment);
+        putU16(out, s->offset);
+        putString(out, s->name);
+    }
+    for (uint32_t i = 0; i < object->relocCount; i++) {
+        AsmReloc* r = &object->relocs[i];
+        putU16(out, r->offset);
+        putU32(out, r->symbol);
+        putU32(out, r->line);
+    }
+    for (uint32_t i = 0; i < object->includeCount; i++) {
+        AsmInclude* inc = &object->includes[i];
+        putU16(out, inc->offset);
+        putU32(out, inc->line);
+        putString(out, inc->path);
+    }
+
+    bool ok = !ferror(out);
+    ok = fclose(out) == 0 && ok;
+    if (ok) ok = rename(tmpPath, path) == 0;
+    if (!ok) remove(tmpPath);
+    return ok;
+}
+
+typedef struct {
+    const uint8_t* data;
+    size_t         left;
+    bool           ok;
+} Reader;
+
+static const uint8_t* Reader_take(Reader* r, size_t n) {
+    if (r->left < n) {
+        r->ok   = false;
+        r->left = 0;
+        return NULL;
+    }
+    const uint8_t* p = r->data;
+    r->data += n;
+    r->left -= n;
+    return p;
+}
+
+static uint16_t Reader_u16(Reader* r) {
+    const uint8_t* p = Reader_take(r, 2);
+    return p ? p[0] | (p[1] << 8) : 0;
+}
+
+static uint32_t Reader_u32(Reader* r) {
+    uint32_t lo = Reader_u16(r);
+    return lo | ((uint32_t)Reader_u16(r) << 16);
+}
+
+static char* Reader_string(Reader* r) {
+    uint16_t       len   = Reader_u16(r);
+    const uint8_t* chars = Reader_take(r, len);
+    char*          s     = chars ? malloc(len + 1) : NULL;
+    if (s == NULL) {
+        r->ok = false;
+        return NULL;
+    }
+    memcpy(s, chars, len);
+    s[len] = '\0';
+    return s;
+}
+
+/**
+ * Loads an object written by AsmObject_write. Anything that is missing,
+ * truncated, from another version or inconsistent is rejected, so callers
+ * can treat false as a cache miss.
+ */
+bool AsmObject_read(AsmObject* object, const char* path) {
+    memset(object, 0, sizeof(AsmObject));
+
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) return false;
+    fseek(in, 0, SEEK_END);
+    long fileSize = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t* data = fileSize > 0 ? malloc(fileSize) : NULL;
+    bool     read = data != NULL && fread(data, 1, fileSize, in) == (size_t)fileSize;
+    fclose(in);
+    if (!read) {
+        free(data);
+        return false;
+    }
+
+    Reader r = { data, fileSize, true };
+    const uint8_t* magic = Reader_take(&r, 4);
+    if (magic == NULL || memcmp(magic, "C8OB", 4) != 0 || Reader_u16(&r) != ASM_OBJECT_VERSION) {
+        free(data);
+        return false;
+    }
+
+    object->size = Reader_u16(&r);
+    uint32_t symbolCount  = Reader_u32(&r);
+    uint32_t relocCount   = Reader_u32(&r);
+    uint32_t includeCount = Reader_u32(&r);
+
+    // Every entry takes at least 7 bytes, which bounds the allocations below
+    if (!r.ok || object->size > MAX_ROM_SZ || (symbolCount + relocCount + includeCount) > r.left / 7) {
+        free(data);
+        return false;
+    }
+
+    const uint8_t* bytes = Reader_take(&r, object->size);
+    object->bytes    = malloc(object->size + 1);
+    object->symbols  = calloc(symbolCount + 1, sizeof(AsmSymbol));
+    object->relocs   = calloc(relocCount + 1, sizeof(AsmReloc));
+    object->includes = calloc(includeCount + 1, sizeof(AsmInclude));
+    object->symbolCount  = symbolCount;
+    object->relocCount   = relocCount;
+    object->includeCount = includeCount;
+    if (bytes == NULL || !object->bytes || !object->symbols || !object->relocs || !object->includes) {
+        r.ok = false;
+    } else {
+        memcpy(object->bytes, bytes, object->size);
+    }
+
+    for (uint32_t i = 0; r.ok && i < symbolCount; i++) {
+        AsmSymbol* s = &object->symbols[i];
+        s->defined = *Reader_take(&r, 1) != 0;
+        s->segment = Reader_u16(&r);
+        s->offset  = Reader_u16(&r);
+        s->name    = Reader_string(&r);
+        if (s->segment > includeCount || s->offset > object->size) r.ok = false;
+    }
+    for (uint32_t i = 0; r.ok && i < relocCount; i++) {
+        AsmReloc* reloc = &object->relocs[i];
+        reloc->offset = Reader_u16(&r);
+        reloc->symbol = Reader_u32(&r);
+        reloc->line   = Reader_u32(&r);
+        if (reloc->symbol >= symbolCount || reloc->offset + 2 > object->size) r.ok = false;
+    }
+    for (uint32_t i = 0; r.ok && i < includeCount; i++) {
+        AsmInclude* inc = &object->includes[i];
+        inc->offset = Reader_u16(&r);
+        inc->line   = Reader_u32(&r);
+        inc->path   = Reader_string(&r);
+        if (inc->offset > object->size || (i > 0 && inc->offset < object->includes[i - 1].offset)) r.ok = false;
+    }
+
+    free(data);
+    if (!r.ok) AsmObject_free(object);
+    return r.ok;
+}
+
+typedef struct {
+    const char* path;         // as reached from the root, for messages
+    const char* realPath;     // canonical, so each file is included once
+    const char* source;       // mapped read-only for as long as the linker lives
+    size_t      sourceSize;
+    bool        mapped;       // source is an mmap rather than arena memory
+    AsmObject   object;
+    uint32_t*   includeUnits; // unit each INCLUDE resolves to
+    uint16_t*   segmentAddrs; // final address of each of the includeCount + 1 segments
+    bool        loading;      // still resolving its INCLUDEs; meeting it again is a cycle
+    bool        placed;
+} Unit;
+
+typedef struct {
+    Arena             arena;
+    SymbolTable       globals; // Symbol.instr holds the defining unit
+    Unit*             units;
+    uint32_t          count;
+    uint32_t          capacity;
+    uint32_t          cached;
+    const AsmOptions* options;
+    AsmRom*           rom;
+    jmp_buf           fail;
+} Linker;
+
+static void linkFail(Linker* linker, const char* file, uint32_t line, const char* format, ...) {
+    AsmRom* rom = linker->rom;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(rom->error, sizeof(rom->error), format, args);
+    va_end(args);
+
+    snprintf(rom->errorFile, sizeof(rom->errorFile), "%s", file);
+    rom->errorLine = line;
+    longjmp(linker->fail, 1);
+}
+
+static uint64_t hashContent(const char* data, size_t size, const AsmOptions* options) {
+    // Objects built with different versions or options must not collide
+    uint64_t hash = 14695981039346656037ull ^ ASM_OBJECT_VERSION; // FNV-1a
+    if (options && options->optimize) hash ^= 0x100;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static char* Linker_strdup(Linker* linker, const char* s) {
+    size_t len  = strlen(s);
+    char*  copy = Arena_alloc(&linker->arena, len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+/**
+ * Maps the unit's source read-only, so the tokens can point straight into
+ * it. Anything that can't be mapped, like a pipe, is read into the arena.
+ */
+static void Linker_mapSource(Linker* linker, Unit* unit) {
+    int fd = open(unit->realPath, O_RDONLY);
+    if (fd < 0) linkFail(linker, unit->path, 0, "Couldn't open file");
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        unit->sourceSize = st.st_size;
+        unit->source     = unit->sourceSize > 0 ? mmap(NULL, unit->sourceSize, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+        close(fd);
+        if (unit->source == MAP_FAILED) linkFail(linker, unit->path, 0, "Couldn't read file");
+        unit->mapped = unit->sourceSize > 0;
+        return;
+    }
+
+    size_t  capacity = 4096;
+    char*   data     = malloc(capacity);
+    size_t  length   = 0;
+    ssize_t got      = 0;
+    while (data != NULL && (got = read(fd, data + length, capacity - length)) > 0) {
+        length += got;
+        if (length == capacity) {
+            char* grown = realloc(data, capacity *= 2);
+            if (grown == NULL) free(data);
+            data = grown;
+        }
+    }
+    close(fd);
+    if (data == NULL || got < 0) {
+        free(data);
+        linkFail(linker, unit->path, 0, "Couldn't read file");
+    }
+
+    char* copy = Arena_alloc(&linker->arena, length > 0 ? length : 1);
+    memcpy(copy, data, length);
+    free(data);
+    unit->source     = copy;
+    unit->sourceSize = length;
+}
+
+static uint32_t Linker_load(Linker* linker, const char* path, const char* from, uint32_t line) {
+    char realPath[PATH_MAX];
+    if (realpath(path, realPath) == NULL) {
+        if (from != NULL) linkFail(linker, from, line, "Couldn't open %s", path);
+        snprintf(realPath, sizeof(realPath), "%s", path); // e.g. a pipe; just try to read it
+    }
+
+    for (uint32_t i = 0; i < linker->count; i++) {
+        if (strcmp(linker->units[i].realPath, realPath) == 0) {
+            if (linker->units[i].loading) linkFail(linker, from, line, "INCLUDE cycle through %s", path);
+            return i;
+        }
+    }
+
+    if (linker->count == linker->capacity) {
+        Unit* old = linker->units;
+        linker->capacity = linker->capacity ? linker->capacity * 2 : 16;
+        linker->units = Arena_alloc(&linker->arena, linker->capacity * sizeof(Unit));
+        if (old) memcpy(linker->units, old, linker->count * sizeof(Unit));
+    }
+    uint32_t index = linker->count++;
+    Unit*    unit  = &linker->units[index];
+    memset(unit, 0, sizeof(Unit));
+    unit->path     = Linker_strdup(linker, path);
+    unit->realPath = Linker_strdup(linker, realPath);
+    Linker_mapSource(linker, unit);
+    const char* source = unit->source;
+    size_t      size   = unit->sourceSize;
+
+    const char* cacheDir = linker->options ? linker->options->cacheDir : NULL;
+    char        objectPath[PATH_MAX];
+    bool        cached = false;
+    if (cacheDir) {
+        snprintf(objectPath, sizeof(objectPath), "%s/%016llx.c8o", cacheDir,
+                 (unsigned long long)hashContent(source, size, linker->options));
+        cached = AsmObject_read(&unit->object, objectPath);
+    }
+
+    FILE* listing = linker->options ? linker->options->listing : NULL;
+    if (listing) {
+        fprintf(listing, "Unit: %s%s\n", unit->path, cached ? " (cached)" : "");
+        fprintf(listing, "Size of source: %zu\n", size);
+        fprintf(listing, "Source: \n");
+        fwrite(source, 1, size, listing);
+        fprintf(listing, "\n");
+    }
+
+    if (cached) {
+        linker->cached++;
+    } else {
+        if (!Asm_compile(source, size, linker->options, &unit->object)) {
+            linkFail(linker, unit->path, unit->object.errorLine, "%s", unit->object.error);
+        }
+        if (cacheDir) {
+            // A failed write only costs a recompile next time
+            mkdir(cacheDir, 0755);
+            AsmObject_write(&unit->object, objectPath);
+        }
+    }
+
+    uint32_t includeCount = unit->object.includeCount;
+    unit->includeUnits = Arena_alloc(&linker->arena, (includeCount + 1) * sizeof(uint32_t));
+    unit->segmentAddrs = Arena_alloc(&linker->arena, (includeCount + 1) * sizeof(uint16_t));
+    unit->loading      = true;
+
+    // Included paths are relative to the directory of the including file
+    const char* slash  = strrchr(unit->path, '/');
+    int         dirLen = slash ? (int)(slash - unit->path) + 1 : 0;
+    for (uint32_t i = 0; i < includeCount; i++) {
+        unit = &linker->units[index]; // loading more units may have moved the array
+        AsmInclude* inc = &unit->object.includes[i];
+
+        char childPath[PATH_MAX];
+        if (inc->path[0] == '/') {
+            snprintf(childPath, sizeof(childPath), "%s", inc->path);
+        } else {
+            snprintf(childPath, sizeof(childPath), "%.*s%s", dirLen, unit->path, inc->path);
+        }
+
+        uint32_t child = Linker_load(linker, childPath, unit->path, inc->line);
+        linker->units[index].includeUnits[i] = child;
+    }
+    linker->units[index].loading = false;
+    return index;
+}
+
+static uint16_t Unit_segmentStart(Unit* unit, uint32_t segment) {
+    return segment == 0 ? 0 : unit->object.includes[segment - 1].offset;
+}
+
+/**
+ * Copies a unit's code into the ROM at *addr, placing each included unit
+ * at its INCLUDE the first time it is reached.
+ */
+static void Linker_place(Linker* linker, uint32_t index, uint32_t* addr) {
+    Unit*      unit   = &linker->units[index];
+    AsmObject* object = &unit->object;
+    unit->placed = true;
+
+    for (uint32_t s = 0; s <= object->includeCount; s++) {
+        uint16_t start = Unit_segmentStart(unit, s);
+        uint16_t end   = s < object->includeCount ? object->includes[s].offset : object->size;
+
+        if (*addr + (end - start) > ROM_LOC + MAX_ROM_SZ) linkFail(linker, unit->path, 0, "Program too large");
+        unit->segmentAddrs[s] = *addr;
+        memcpy(linker->rom->bytes + (*addr - ROM_LOC), object->bytes + start, end - start);
+        *addr += end - start;
+
+        if (s < object->includeCount && !linker->units[unit->includeUnits[s]].placed) {
+            Linker_place(linker, unit->includeUnits[s], addr);
+        }
+    }
+}
+
+static void Linker_define(Linker* linker, uint32_t index) {
+    Unit* unit = &linker->units[index];
+    for (uint32_t i = 0; i < unit->object.symbolCount; i++) {
+        AsmSymbol* s = &unit->object.symbols[i];
+        if (!s->defined) continue;
+
+        StrView  name  = { s->name, strlen(s->name) };
+        uint32_t slot  = SymbolTable_intern(&linker->globals, &linker->arena, name);
+        Symbol*  label = &linker->globals.symbols[slot];
+        if (label->instr >= 0) {
+            linkFail(linker, unit->path, 0, "Duplicate label \"%s\" (also in %s)",
+                     s->name, linker->units[label->instr].path);
+        }
+        label->instr = index;
+        label->addr  = unit->segmentAddrs[s->segment] + (s->offset - Unit_segmentStart(unit, s->segment));
+    }
+}
+
+static void Linker_relocate(Linker* linker, uint32_t index) {
+    Unit* unit = &linker->units[index];
+    for (uint32_t i = 0; i < unit->object.relocCount; i++) {
+        AsmReloc* reloc = &unit->object.relocs[i];
+
+        // Code at an INCLUDE's offset comes after the included file
+        uint32_t segment = 0;
+        while (segment < unit->object.includeCount && unit->object.includes[segment].offset <= reloc->offset) {
+            segment++;
+        }
+
+        const char* name  = unit->object.symbols[reloc->symbol].name;
+        uint32_t    slot  = SymbolTable_intern(&linker->globals, &linker->arena, (StrView){ name, strlen(name) });
+        Symbol*     label = &linker->globals.symbols[slot];
+        if (label->instr < 0) linkFail(linker, unit->path, reloc->line, "Unknown identifier \"%s\"", name);
+
+        uint16_t pos = unit->segmentAddrs[segment] + (reloc->offset - Unit_segmentStart(unit, segment)) - ROM_LOC;
+        linker->rom->bytes[pos]     |= (label->addr >> 8) & 0xF;
+        linker->rom->bytes[pos + 1]  = label->addr & 0xFF;
+    }
+}
+
+/**
+ * The listing of the linked ROM: where each file's code went, every label
+ * at its final address and the bytes as they are in the ROM.
+ */
+static void Linker_list(Linker* linker, FILE* out) {
+    fprintf(out, "Linked %u units (%u from cache)\n", linker->count, linker->cached);
+
+    // The segments tile the ROM, so following each one's end lists them in order
+    fputs("===\n", out);
+    uint32_t addr = ROM_LOC;
+    while (addr < ROM_LOC + linker->rom->size) {
+        uint32_t next = addr;
+        for (uint32_t i = 0; i < linker->count && next == addr; i++) {
+            Unit* unit = &linker->units[i];
+            for (uint32_t s = 0; s <= unit->object.includeCount; s++) {
+                uint16_t start = Unit_segmentStart(unit, s);
+                uint16_t end   = s < unit->object.includeCount ? unit->object.includes[s].offset : unit->object.size;
+                if (end == start || unit->segmentAddrs[s] != addr) continue;
+                next = addr + (end - start);
+                fprintf(out, "0x%04X-0x%04X: %s\n", addr, next, unit->path);
+                break;
+            }
+        }
+        if (next == addr) break; // can't happen; don't spin if it does
+        addr = next;
+    }
+
+    fputs("===\n", out);
+    for (uint32_t i = 0; i < linker->count; i++) {
+        Unit* unit = &linker->units[i];
+        for (uint32_t j = 0; j < unit->object.symbolCount; j++) {
+            AsmSymbol* s = &unit->object.symbols[j];
+            if (!s->defined) continue;
+            uint16_t addr = unit->segmentAddrs[s->segment] + (s->offset - Unit_segmentStart(unit, s->segment));
+            fprintf(out, "Label: %s (0x%04X)\n", s->name, addr);
+        }
+    }
+    fputs("===\n", out);
+    Rom_dump(linker->rom, out);
+}
+
+bool Asm_build(const char* path, const AsmOptions* options, AsmRom* rom) {
+    rom->size         = 0;
+    rom->errorLine    = 0;
+    rom->errorFile[0] = '\0';
+    rom->error[0]     = '\0';
+
+    Linker* linker = malloc(sizeof(Linker));
+    if (linker == NULL) {
+        snprintf(rom->error, sizeof(rom->error), "Out of memory");
+        return false;
+    }
+    Arena_init(&linker->arena, &linker->fail);
+    linker->units    = NULL;
+    linker->count    = 0;
+    linker->capacity = 0;
+    linker->cached   = 0;
+    linker->options  = options;
+    linker->rom      = rom;
+
+    bool ok = false;
+    if (setjmp(linker->fail) == 0) {
+        SymbolTable_init(&linker->globals, &linker->arena, 256);
+        uint32_t root = Linker_load(linker, path, NULL, 0);
+
+        uint32_t addr = ROM_LOC;
+        Linker_place(linker, root, &addr);
+        rom->size = addr - ROM_LOC;
+
+        for (uint32_t i = 0; i < linker->count; i++) {
+            Linker_define(linker, i);
+        }
+        for (uint32_t i = 0; i < linker->count; i++) {
+            Linker_relocate(linker, i);
+        }
+
+        if (options && options->listing) Linker_list(linker, options->listing);
+        ok = true;
+    } else if (rom->error[0] == '\0') {
+        snprintf(rom->error, sizeof(rom->error), "Out of memory");
+    }
+
+    for (uint32_t i = 0; i < linker->count; i++) {
+        Unit* unit = &linker->units[i];
+        AsmObject_free(&unit->object);
+        if (unit->mapped) munmap((void*)unit->source, unit->sourceSize);
+    }
+    Arena_free(&linker->arena);
+    free(linker);
+    if (!ok) rom->size = 0;
+    return ok;
+}
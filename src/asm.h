@@ -0,0 +1,96 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ASM_ROM_LOC    0x200  // 512
+#define ASM_MAX_ROM_SZ (0x1000 - ASM_ROM_LOC)
+
+#define ASM_OBJECT_VERSION 1
+
+typedef struct {
+    FILE*       listing;  // if not NULL, receives each file's parsed program and object code, then the linked ROM
+    const char* cacheDir; // Asm_build keeps compiled units here; NULL disables the cache
+    bool        optimize; // run the peephole pass between parsing and encoding
+} AsmOptions;
+
+typedef struct {
+    uint8_t  bytes[ASM_MAX_ROM_SZ];
+    size_t   size;
+    uint32_t errorLine;     // 0 if the error is not tied to a line
+    char     errorFile[256]; // set by Asm_build to the file the error is in
+    char     error[256];
+} AsmRom;
+
+typedef struct {
+    char*    name;
+    bool     defined; // false for labels this unit uses but another one defines
+    uint16_t segment; // number of INCLUDEs before the definition
+    uint16_t offset;  // byte offset into this unit's own code
+} AsmSymbol;
+
+/**
+ * The low 12 bits of the instruction at offset take the address of symbol
+ * once the final layout is known.
+ */
+typedef struct {
+    uint16_t offset;
+    uint32_t symbol;
+    uint32_t line;
+} AsmReloc;
+
+typedef struct {
+    uint16_t offset; // where the included file's code goes
+    uint32_t line;
+    char*    path;   // as written, relative to the including file
+} AsmInclude;
+
+/**
+ * One assembled source file. Every label operand is left as a relocation,
+ * so the object depends only on the file's own text and can be cached by
+ * its content hash.
+ */
+typedef struct {
+    uint8_t*    bytes;
+    uint16_t    size;
+    AsmSymbol*  symbols;
+    uint32_t    symbolCount;
+    AsmReloc*   relocs;
+    uint32_t    relocCount;
+    AsmInclude* includes;
+    uint32_t    includeCount;
+    uint32_t    errorLine;
+    char        error[256];
+} AsmObject;
+
+/**
+ * Assembles length bytes of source text into an in-memory ROM image, ready
+ * to be loaded at 0x200. The source does not need to be NUL terminated.
+ * Returns false and fills in rom->error if the source is invalid; nothing
+ * is printed and the process is never exited. options may be NULL.
+ */
+bool Asm_assemble(const char* source, size_t length, const AsmOptions* options, AsmRom* rom);
+
+/**
+ * Assembles one source file into a relocatable object. INCLUDE directives
+ * are recorded, not followed. Returns false and fills in object->error if
+ * the source is invalid.
+ */
+bool Asm_compile(const char* source, size_t length, const AsmOptions* options, AsmObject* object);
+
+void AsmObject_free(AsmObject* object);
+bool AsmObject_write(const AsmObject* object, const char* path);
+bool AsmObject_read(AsmObject* object, const char* path);
+
+/**
+ * Assembles the file at path and everything it INCLUDEs, then links the
+ * units into one ROM. Each file is included once, at its first INCLUDE.
+ * Units whose content hash matches an object in options->cacheDir are
+ * loaded from there instead of being assembled again.
+ */
+bool Asm_build(const char* path, const AsmOptions* options, AsmRom* rom);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "audio.h"
+
+static void audioCallback(void* userdata, uint8_t* stream, int len) {
+    Audio*   audio  = userdata;
+    int16_t* out    = (int16_t*)stream;
+    uint32_t wanted = len / sizeof(int16_t);
+
+    uint32_t got = Ring_pop(&audio->samples, out, wanted);
+    if (got < wanted) {
+        memset(out + got, 0, (wanted - got) * sizeof(int16_t));
+        audio->underruns++;
+    }
+}
+
+bool Audio_init(Audio* audio, int latencyMs) {
+    memset(audio, 0, sizeof(Audio));
+    if (latencyMs < 1) latencyMs = 1;
+
+    // SDL wants a power of two for the device buffer
+    uint32_t wanted = AUDIO_SAMPLE_RATE * latencyMs / 1000;
+    uint32_t deviceSamples = 64;
+    while (deviceSamples < wanted) {
+        deviceSamples <<= 1;
+    }
+
+    audio->samplesPerTick = AUDIO_SAMPLE_RATE / AUDIO_TICK_HZ;
+    audio->deviceSamples  = deviceSamples;
+
+    // One tick must always fit on top of what the device is still playing
+    if (!Ring_init(&audio->samples, sizeof(int16_t), 2 * (audio->samplesPerTick + deviceSamples))) {
+        return false;
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        printf("Couldn't initialize audio: %s\n", SDL_GetError());
+        Ring_free(&audio->samples);
+        return false;
+    }
+
+    SDL_AudioSpec want;
+    SDL_AudioSpec have;
+    memset(&want, 0, sizeof(want));
+    want.freq     = AUDIO_SAMPLE_RATE;
+    want.format   = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples  = deviceSamples;
+    want.callback = audioCallback;
+    want.userdata = audio;
+
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    if (audio->device == 0) {
+        printf("Couldn't open audio device: %s\n", SDL_GetError());
+        Ring_free(&audio->samples);
+        return false;
+    }
+    audio->deviceSamples = have.samples;
+
+    printf("Audio: %d Hz, %u sample buffer (%.1f ms)\n", have.freq, have.samples,
+           have.samples * 1000.0 / have.freq);
+    SDL_PauseAudioDevice(audio->device, 0);
+    return true;
+}
+
+void Audio_tick(Audio* audio, bool on) {
+    if (audio->device == 0) return;
+
+    // Keep about one tick plus the device buffer queued: enough to ride
+    // out a late tick, without latency building up when the clocks drift
+    uint32_t queued = Ring_size(&audio->samples);
+    uint32_t target = audio->samplesPerTick + audio->deviceSamples;
+    if (queued >= target) return;
+
+    uint32_t count = target - queued;
+    if (count > audio->samplesPerTick) count = audio->samplesPerTick;
+
+    int16_t  buf[AUDIO_SAMPLE_RATE / AUDIO_TICK_HZ];
+    uint32_t halfPeriod = AUDIO_SAMPLE_RATE / AUDIO_TONE_HZ / 2;
+    for (uint32_t i = 0; i < count; i++) {
+        if (on) {
+            buf[i] = (audio->phase / halfPeriod) % 2 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+            audio->phase++;
+        } else {
+            buf[i] = 0;
+            audio->phase = 0; // start every beep on the same edge
+        }
+    }
+    Ring_push(&audio->samples, buf, count);
+}
+
+void Audio_close(Audio* audio) {
+    if (audio->device == 0) return;
+    SDL_CloseAudioDevice(audio->device);
+    audio->device = 0;
+    if (audio->underruns > 0) printf("Audio: %u buffer underruns\n", audio->underruns);
+    Ring_free(&audio->samples);
+}
@@ -0,0 +1,44 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL2/sdl.h>
+
+#include "ring.h"
+
+#define AUDIO_SAMPLE_RATE  48000
+#define AUDIO_TONE_HZ      440
+#define AUDIO_VOLUME       3000
+#define AUDIO_TICK_HZ      60
+#define AUDIO_DEFAULT_MS   20
+
+/**
+ * Square-wave beeper. The emulation side calls Audio_tick once per 60 Hz
+ * timer tick; the SDL callback only copies samples out of the ring.
+ */
+typedef struct {
+    SDL_AudioDeviceID device;
+    Ring              samples; // int16_t, emulation thread -> audio callback
+    uint32_t          deviceSamples;
+    uint32_t          samplesPerTick;
+    uint32_t          phase;   // producer-side position in the wave, in samples
+    uint32_t          underruns; // callback ran dry; only the callback writes it
+} Audio;
+
+/**
+ * Opens the default output with a device buffer of about latencyMs
+ * milliseconds (5 ms and up is reasonable). Returns false if there is no
+ * audio device; Audio_tick is then a no-op.
+ */
+bool Audio_init(Audio* audio, int latencyMs);
+
+/**
+ * Queues one tick's worth of samples: the tone while on, silence
+ * otherwise. Never blocks; samples that don't fit are dropped.
+ */
+void Audio_tick(Audio* audio, bool on);
+
+void Audio_close(Audio* audio);
+
+#endif
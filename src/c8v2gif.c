@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator.h"
+#include "recorder.h"
+
+#define DEFAULT_SCALE 4
+#define MAX_SCALE     16
+
+#define LZW_MIN_CODE_SIZE 2 // four colours
+#define LZW_CLEAR         (1 << LZW_MIN_CODE_SIZE)
+#define LZW_END           (LZW_CLEAR + 1)
+#define LZW_MAX_CODES     4096
+
+// Same colours as the SDL frontend, per EmuDisplay_pixel index
+static const uint8_t PALETTE[1 << SCREEN_PLANES][3] = {
+    { 0x00, 0x00, 0x00 }, { 0xFF, 0xFF, 0xFF }, { 0x80, 0x80, 0x80 }, { 0xC0, 0xC0, 0xC0 }
+};
+
+/**
+ * Packs LZW codes LSB first into the 255-byte sub-blocks GIF image data
+ * is made of.
+ */
+typedef struct {
+    FILE*    out;
+    uint32_t bits;
+    int      bitCount;
+    uint8_t  block[255];
+    int      blockSize;
+} BitWriter;
+
+static void flushBlock(BitWriter* writer) {
+    if (writer->blockSize == 0) return;
+    fputc(writer->blockSize, writer->out);
+    fwrite(writer->block, 1, writer->blockSize, writer->out);
+    writer->blockSize = 0;
+}
+
+static void writeCode(BitWriter* writer, int code, int codeSize) {
+    writer->bits     |= (uint32_t)code << writer->bitCount;
+    writer->bitCount += codeSize;
+    while (writer->bitCount >= 8) {
+        writer->block[writer->blockSize++] = writer->bits & 0xFF;
+        writer->bits    >>= 8;
+        writer->bitCount -= 8;
+        if (writer->blockSize == 255) flushBlock(writer);
+    }
+}
+
+/**
+ * LZW-compresses count colour indices. With only four colours, the string
+ * table fits in a plain array of each code's four possible extensions.
+ */
+static void writeImageData(FILE* out, const uint8_t* pixels, int count) {
+    static uint16_t next[LZW_MAX_CODES][1 << LZW_MIN_CODE_SIZE]; // 0: not in the table yet
+
+    BitWriter writer = { out, 0, 0, { 0 }, 0 };
+    int codeSize = LZW_MIN_CODE_SIZE + 1;
+    int nextCode = LZW_END + 1;
+    memset(next, 0, sizeof(next));
+
+    fputc(LZW_MIN_CODE_SIZE, out);
+    writeCode(&writer, LZW_CLEAR, codeSize);
+
+    int prefix = pixels[0];
+    for (int i = 1; i < count; i++) {
+        uint8_t pixel = pixels[i];
+        if (next[prefix][pixel] != 0) {
+            prefix = next[prefix][pixel];
+            continue;
+        }
+
+        writeCode(&writer, prefix, codeSize);
+        if (nextCode < LZW_MAX_CODES) {
+            next[prefix][pixel] = nextCode++;
+            if (nextCode > (1 << codeSize) && codeSize < 12) codeSize++;
+        } else { // table full; start over
+            writeCode(&writer, LZW_CLEAR, codeSize);
+            memset(next, 0, sizeof(next));
+            codeSize = LZW_MIN_CODE_SIZE + 1;
+            nextCode = LZW_END + 1;
+        }
+        prefix = pixel;
+    }
+    writeCode(&writer, prefix, codeSize);
+    // Decoders add a table entry for that last code too, and widen the
+    // codes if it fills the current size
+    if (nextCode < LZW_MAX_CODES && nextCode + 1 > (1 << codeSize) && codeSize < 12) codeSize++;
+    writeCode(&writer, LZW_END, codeSize);
+    if (writer.bitCount > 0) writeCode(&writer, 0, 8 - writer.bitCount);
+    flushBlock(&writer);
+    fputc(0, out); // no more sub-blocks
+}
+
+static void writeU16(FILE* out, uint16_t value) {
+    fputc(value & 0xFF, out);
+    fputc(value >> 8, out);
+}
+
+static void writeHeader(FILE* out, int width, int height) {
+    fwrite("GIF89a", 1, 6, out);
+    writeU16(out, width);
+    writeU16(out, height);
+    fputc(0x80 | (1 << 4) | 1, out); // global palette of 2^(1+1) colours, 2 bits each
+    fputc(0, out);                   // background colour
+    fputc(0, out);                   // square pixels
+    fwrite(PALETTE, 1, sizeof(PALETTE), out);
+
+    // Loop forever
+    fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, out);
+}
+
+/**
+ * Writes the part of frame inside the rectangle (in screen pixels) as an
+ * image shown for delay hundredths of a second, drawn over what came before.
+ */
+static void writeFrame(FILE* out, const uint8_t* frame, int scale, int x0, int y0, int x1, int y1, int delay) {
+    fwrite("\x21\xF9\x04\x04", 1, 4, out); // graphic control: keep the previous image underneath
+    writeU16(out, delay);
+    fputc(0, out);
+    fputc(0, out);
+
+    int width  = (x1 - x0) * scale;
+    int height = (y1 - y0) * scale;
+    fputc(0x2C, out);
+    writeU16(out, x0 * scale);
+    writeU16(out, y0 * scale);
+    writeU16(out, width);
+    writeU16(out, height);
+    fputc(0, out); // no local palette, not interlaced
+
+    uint8_t* pixels = malloc(width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            pixels[y * width + x] = frame[(y0 + y / scale) * HIRES_WIDTH + x0 + x / scale];
+        }
+    }
+    writeImageData(out, pixels, width * height);
+    free(pixels);
+}
+
+/**
+ * Colour indices for the whole screen, low-res pixels doubled the way the
+ * SDL frontend shows them.
+ */
+static void renderDisplay(const EmuDisplay* display, uint8_t* frame) {
+    int shift = display->hires ? 0 : 1;
+    for (int y = 0; y < HIRES_HEIGHT; y++) {
+        for (int x = 0; x < HIRES_WIDTH; x++) {
+            frame[y * HIRES_WIDTH + x] = EmuDisplay_pixel(display, x >> shift, y >> shift);
+        }
+    }
+}
+
+/**
+ * Hundredths of a second from the start of the recording to a tick.
+ */
+static uint32_t centiseconds(uint32_t tick, int rate) {
+    return (uint32_t)((uint64_t)tick * 100 / rate);
+}
+
+int main(int argc, const char* argv[]) {
+    const char* filename = NULL;
+    const char* outname  = "out.gif";
+    int scale = DEFAULT_SCALE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outname = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            scale = atoi(argv[++i]);
+            if (scale < 1) scale = 1;
+            if (scale > MAX_SCALE) scale = MAX_SCALE;
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    if (filename == NULL) {
+        printf("Missing argument: filename.\nUsage: c8v2gif [-s scale] [-o out.gif] <recording.c8v>\n");
+        return 1;
+    }
+
+    RecordingReader reader;
+    if (!RecordingReader_open(&reader, filename)) return 1;
+    int rate = reader.rate > 0 ? reader.rate : TIMER_HZ;
+
+    FILE* out = fopen(outname, "wb");
+    if (out == NULL) {
+        printf("Couldn't create %s\n", outname);
+        RecordingReader_close(&reader);
+        return 1;
+    }
+    writeHeader(out, HIRES_WIDTH * scale, HIRES_HEIGHT * scale);
+
+    // Each frame is written once the next one shows how long it lasted.
+    // Frames that change nothing only lengthen the one before
+    static uint8_t shown[HIRES_WIDTH * HIRES_HEIGHT];   // what the GIF shows so far
+    static uint8_t pending[HIRES_WIDTH * HIRES_HEIGHT]; // the frame waiting for its delay
+    static uint8_t latest[HIRES_WIDTH * HIRES_HEIGHT];
+    bool     hasPending = false;
+    uint32_t pendingTick = 0;
+    int      frames = 0;
+    int      images = 0;
+
+    EmuDisplay display;
+    uint32_t   tick;
+    for (;;) {
+        bool more = RecordingReader_next(&reader, &display, &tick);
+        if (more) {
+            renderDisplay(&display, latest);
+            frames++;
+            if (hasPending && memcmp(latest, pending, sizeof(latest)) == 0) continue;
+        }
+
+        if (hasPending) {
+            uint32_t end   = more ? tick : pendingTick + rate; // hold the last frame for a second
+            int      delay = centiseconds(end, rate) - centiseconds(pendingTick, rate);
+            if (delay > 0xFFFF) delay = 0xFFFF;
+
+            // Only the rectangle that changed; the first frame is all of it
+            int x0 = HIRES_WIDTH, y0 = HIRES_HEIGHT, x1 = 0, y1 = 0;
+            for (int y = 0; y < HIRES_HEIGHT; y++) {
+                for (int x = 0; x < HIRES_WIDTH; x++) {
+                    int i = y * HIRES_WIDTH + x;
+                    if (images > 0 && pending[i] == shown[i]) continue;
+                    if (x < x0) x0 = x;
+                    if (y < y0) y0 = y;
+                    if (x >= x1) x1 = x + 1;
+                    if (y >= y1) y1 = y + 1;
+                }
+            }
+            if (x1 == 0) { x0 = 0; y0 = 0; x1 = 1; y1 = 1; } // unchanged since the GIF's last image
+
+            if (delay > 0) { // two frames within one hundredth: the second one wins
+                writeFrame(out, pending, scale, x0, y0, x1, y1, delay);
+                memcpy(shown, pending, sizeof(shown));
+                images++;
+            }
+        }
+        if (!more) break;
+
+        memcpy(pending, latest, sizeof(pending));
+        pendingTick = tick;
+        hasPending  = true;
+    }
+
+    fputc(0x3B, out); // trailer
+    RecordingReader_close(&reader);
+    if (fclose(out) != 0) {
+        printf("Failed to write %s\n", outname);
+        return 1;
+    }
+    printf("Wrote %d images for %d frames to %s\n", images, frames, outname);
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include <string.h>
+
+#include "cfg.h"
+#include "opcodes.h"
+
+void Cfg_init(Cfg* cfg) {
+    memset(cfg, 0, sizeof(Cfg));
+}
+
+void Cfg_free(Cfg* cfg) {
+    free(cfg->blocks);
+    cfg->blocks = NULL;
+    cfg->blockCount = 0;
+    cfg->blockCapacity = 0;
+}
+
+static uint16_t readOpcode(const uint8_t* memory, uint16_t addr) {
+    return memory[addr] << 8 | memory[addr + 1];
+}
+
+static bool inRom(const Cfg* cfg, uint16_t addr) {
+    return addr >= cfg->base && addr + 1 < cfg->limit;
+}
+
+/**
+ * The size of the instruction at addr: four bytes for XO-CHIP's F000 nnnn
+ * when its operand is still inside the ROM, two otherwise.
+ */
+static uint16_t instrLength(const Cfg* cfg, const uint8_t* memory, uint16_t addr) {
+    return readOpcode(memory, addr) == 0xF000 && inRom(cfg, addr + 2) ? 4 : 2;
+}
+
+/**
+ * Works out how the instruction at addr transfers control. Returns true if
+ * it ends a basic block, in which case exit and succ describe how.
+ */
+static bool classify(const Cfg* cfg, const uint8_t* memory, uint16_t addr,
+                     BlockExit* exit, uint16_t succ[2], uint8_t* succCount) {
+    uint16_t opcode = readOpcode(memory, addr);
+    uint16_t nnn = opcode & 0x0FFF;
+    *succCount = 0;
+
+    if (Opcode_kind(opcode) == OP_UNKNOWN) {
+        *exit = BLOCK_INVALID;
+        return true;
+    }
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00EE) {
+                *exit = BLOCK_RETURN;
+                return true;
+            }
+            if (opcode == 0x00FD) { // SUPER-CHIP EXIT
+                *exit = BLOCK_HALT;
+                return true;
+            }
+            return false;
+
+        case 0x1000:
+            if (nnn == addr) {
+                *exit = BLOCK_HALT;
+                return true;
+            }
+            *exit = BLOCK_JUMP;
+            succ[(*succCount)++] = nnn;
+            return true;
+
+        case 0x2000:
+            *exit = BLOCK_CALL;
+            succ[(*succCount)++] = nnn;
+            succ[(*succCount)++] = addr + 2;
+            return true;
+
+        case 0x5000:
+            if ((opcode & 0x000F) != 0) return false; // XO-CHIP 5xy2 / 5xy3
+            // fall through
+        case 0x3000:
+        case 0x4000:
+        case 0x9000:
+        case 0xE000:
+            *exit = BLOCK_SKIP;
+            succ[(*succCount)++] = addr + 2;
+            succ[(*succCount)++] = addr + 2 + (inRom(cfg, addr + 2) ? instrLength(cfg, memory, addr + 2) : 2);
+            return true;
+
+        case 0xB000:
+            // The real target depends on V0; nnn is the base of what is
+            // almost always a jump table, so it is at least worth visiting.
+            *exit = BLOCK_INDIRECT;
+            succ[(*succCount)++] = nnn;
+            return true;
+    }
+
+    return false;
+}
+
+static void addBlock(Cfg* cfg, BasicBlock* block) {
+    if (cfg->blockCount == cfg->blockCapacity) {
+        cfg->blockCapacity = cfg->blockCapacity ? cfg->blockCapacity * 2 : 64;
+        cfg->blocks = realloc(cfg->blocks, cfg->blockCapacity * sizeof(BasicBlock));
+    }
+    cfg->blocks[cfg->blockCount++] = *block;
+}
+
+bool Cfg_build(Cfg* cfg, const uint8_t* memory, uint16_t base, uint16_t limit) {
+    if (limit > CFG_MEM_SZ || base >= limit) return false;
+
+    Cfg_free(cfg);
+    memset(cfg->flags, 0, sizeof(cfg->flags));
+    cfg->base  = base;
+    cfg->limit = limit;
+
+    // Every decoded instruction pushes at most two successors
+    uint16_t worklist[CFG_MEM_SZ * 2 + 1];
+    size_t   pending = 0;
+
+    worklist[pending++] = base;
+    cfg->flags[base] |= CFG_LEADER;
+
+    { // Traverse reachable code
+        while (pending > 0) {
+            uint16_t addr = worklist[--pending];
+
+            while (inRom(cfg, addr) && !(cfg->flags[addr] & CFG_INSTR)) {
+                uint16_t  opcode = readOpcode(memory, addr);
+                uint16_t  length = instrLength(cfg, memory, addr);
+                BlockExit exit;
+                uint16_t  succ[2];
+                uint8_t   succCount;
+
+                cfg->flags[addr] |= CFG_INSTR;
+                for (uint16_t i = 0; i < length; i++) {
+                    cfg->flags[addr + i] |= CFG_CODE;
+                }
+
+                if ((opcode & 0xF000) == 0xA000 && (opcode & 0x0FFF) < CFG_MEM_SZ) {
+                    cfg->flags[opcode & 0x0FFF] |= CFG_DATA_REF;
+                }
+                if (length == 4 && readOpcode(memory, addr + 2) < CFG_MEM_SZ) {
+                    cfg->flags[readOpcode(memory, addr + 2)] |= CFG_DATA_REF;
+                }
+
+                if (!classify(cfg, memory, addr, &exit, succ, &succCount)) {
+                    addr += length;
+                    continue;
+                }
+
+                for (int i = 0; i < succCount; i++) {
+                    if (succ[i] >= CFG_MEM_SZ) continue;
+                    cfg->flags[succ[i]] |= CFG_LEADER;
+                    if (exit == BLOCK_CALL && i == 0) {
+                        cfg->flags[succ[i]] |= CFG_CALL_TGT;
+                    } else if (exit != BLOCK_CALL) {
+                        cfg->flags[succ[i]] |= CFG_JUMP_TGT;
+                    }
+                    worklist[pending++] = succ[i];
+                }
+                break;
+            }
+        }
+    }
+
+    { // Split into basic blocks
+        for (uint16_t addr = base; addr < limit; addr++) {
+            uint8_t f = cfg->flags[addr];
+            if (!(f & CFG_INSTR) || !(f & CFG_LEADER)) continue;
+
+            BasicBlock block;
+            memset(&block, 0, sizeof(BasicBlock));
+            block.start = addr;
+
+            uint16_t pc = addr;
+            for (;;) {
+                BlockExit exit;
+
+                if (classify(cfg, memory, pc, &exit, block.succ, &block.succCount)) {
+                    block.exit = exit;
+                    block.end  = pc + 2;
+                    break;
+                }
+
+                pc += instrLength(cfg, memory, pc);
+                if (!inRom(cfg, pc) || !(cfg->flags[pc] & CFG_INSTR)) {
+                    block.exit = BLOCK_INVALID;
+                    block.end  = pc;
+                    break;
+                }
+                if (cfg->flags[pc] & CFG_LEADER) {
+                    block.exit = BLOCK_FALLTHROUGH;
+                    block.end  = pc;
+                    block.succ[block.succCount++] = pc;
+                    break;
+                }
+            }
+
+            addBlock(cfg, &block);
+        }
+    }
+
+    return true;
+}
+
+const BasicBlock* Cfg_findBlock(const Cfg* cfg, uint16_t addr) {
+    size_t lo = 0;
+    size_t hi = cfg->blockCount;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const BasicBlock* b = &cfg->blocks[mid];
+        if (addr < b->start) {
+            hi = mid;
+        } else if (addr >= b->end) {
+            lo = mid + 1;
+        } else {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+bool Cfg_isCode(const Cfg* cfg, uint16_t addr) {
+    return addr < CFG_MEM_SZ && (cfg->flags[addr] & CFG_CODE);
+}
+
+const char* Cfg_exitName(BlockExit exit) {
+    switch (exit) {
+        case BLOCK_FALLTHROUGH: return "fallthrough";
+        case BLOCK_JUMP:        return "jump";
+        case BLOCK_CALL:        return "call";
+        case BLOCK_SKIP:        return "skip";
+        case BLOCK_RETURN:      return "return";
+        case BLOCK_INDIRECT:    return "indirect";
+        case BLOCK_HALT:        return "halt";
+        case BLOCK_INVALID:     return "invalid";
+    }
+    return "?";
+}
+
+void Cfg_printDot(const Cfg* cfg, FILE* out) {
+    fprintf(out, "digraph cfg {\n");
+    fprintf(out, "    node [shape=box fontname=monospace];\n");
+    for (size_t i = 0; i < cfg->blockCount; i++) {
+        const BasicBlock* b = &cfg->blocks[i];
+        fprintf(out, "    b%04X [label=\"%04X-%04X\\n%s\"];\n",
+                b->start, b->start, b->end - 1, Cfg_exitName(b->exit));
+        for (int j = 0; j < b->succCount; j++) {
+            if (!Cfg_isCode(cfg, b->succ[j])) continue;
+            fprintf(out, "    b%04X -> b%04X;\n", b->start, b->succ[j]);
+        }
+    }
+    fprintf(out, "}\n");
+}
@@ -0,0 +1,64 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define CFG_MEM_SZ 0x1000 // 4096
+
+// Per-byte classification flags, stored in Cfg.flags
+enum {
+    CFG_CODE     = 1 << 0, // byte is part of a reachable instruction
+    CFG_INSTR    = 1 << 1, // first byte of a reachable instruction
+    CFG_LEADER   = 1 << 2, // first instruction of a basic block
+    CFG_JUMP_TGT = 1 << 3, // target of JP / JP V0 / skip
+    CFG_CALL_TGT = 1 << 4, // target of CALL
+    CFG_DATA_REF = 1 << 5, // loaded into I by LD I, nnn
+};
+
+typedef enum {
+    BLOCK_FALLTHROUGH, // runs into the next block
+    BLOCK_JUMP,        // JP nnn
+    BLOCK_CALL,        // CALL nnn, returns to the next instruction
+    BLOCK_SKIP,        // SE / SNE / SKP / SKNP
+    BLOCK_RETURN,      // RET
+    BLOCK_INDIRECT,    // JP V0, nnn; target unknown statically
+    BLOCK_HALT,        // JP to itself
+    BLOCK_INVALID      // undecodable opcode or ran off the ROM
+} BlockExit;
+
+typedef struct {
+    uint16_t start;     // address of the first instruction
+    uint16_t end;       // one past the last byte of the last instruction
+    uint16_t succ[2];
+    uint8_t  succCount;
+    uint8_t  exit;      // BlockExit
+} BasicBlock;
+
+typedef struct {
+    uint16_t    base;   // entry point, usually 0x200
+    uint16_t    limit;  // one past the last ROM byte
+    uint8_t     flags[CFG_MEM_SZ];
+    BasicBlock* blocks; // sorted by start address
+    size_t      blockCount;
+    size_t      blockCapacity;
+} Cfg;
+
+void Cfg_init(Cfg* cfg);
+void Cfg_free(Cfg* cfg);
+
+/**
+ * Recursively traverses the program in memory starting at base, following
+ * jumps, calls, skips and returns, and splits the reachable code into basic
+ * blocks. Bytes in [base, limit) that are never reached are data.
+ */
+bool Cfg_build(Cfg* cfg, const uint8_t* memory, uint16_t base, uint16_t limit);
+
+const BasicBlock* Cfg_findBlock(const Cfg* cfg, uint16_t addr);
+bool Cfg_isCode(const Cfg* cfg, uint16_t addr);
+const char* Cfg_exitName(BlockExit exit);
+void Cfg_printDot(const Cfg* cfg, FILE* out);
+
+#endif
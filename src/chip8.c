@@ -2,61 +2,97 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <stdatomic.h>
 #include <SDL2/sdl.h>
 
-#include "font.h"
+#include "emulator.h"
+#include "asm.h"
+#include "watch.h"
+#include "audio.h"
+#include "input.h"
+#include "triplebuffer.h"
+#include "recorder.h"
+#include "metrics.h"
+#include "heatmap.h"
+#include "romdb.h"
+#include "pool.h"
+#include "scaler.h"
+#include "phosphor.h"
 
-#ifndef CHIP8_DEBUG
-#define CHIP8_DEBUG 0
-#endif
+// Frames are paced to the timer rate; each one runs cyclesPerFrame instructions
+#define SCREEN_FPS                TIMER_HZ
+#define DEFAULT_CYCLES_PER_FRAME  10
 
-#define debug_print(...) \
-    do { if (CHIP8_DEBUG > 0) fprintf(stdout, __VA_ARGS__); } while (0)
+#define WINDOW_WIDTH  640
+#define WINDOW_HEIGHT 320
+#define PIXEL_WIDTH   (WINDOW_WIDTH / SCREEN_WIDTH)
+#define PIXEL_HEIGHT  (WINDOW_HEIGHT / SCREEN_HEIGHT)
 
-// For use later in framerate capping
-const int SCREEN_FPS   = 60;
-const int SCREEN_TICKS_PER_FRAME = 1000 / SCREEN_FPS;
+#define MIN_COMMAND_KEY   SDLK_j
+#define MAX_COMMAND_KEY   SDLK_l
+#define COMMAND_KEY_COUNT (MAX_COMMAND_KEY - MIN_COMMAND_KEY + 1)
 
-const int WINDOW_WIDTH  = 640;
-const int WINDOW_HEIGHT = 320;
-const int SCREEN_WIDTH  = 64;
-const int SCREEN_HEIGHT = 32;
-const int PIXEL_WIDTH   = WINDOW_WIDTH / SCREEN_WIDTH;
-const int PIXEL_HEIGHT  = WINDOW_HEIGHT / SCREEN_HEIGHT;
+#define WATCH_INTERVAL_MS 100
 
-const int MEMORY_SIZE  = 4096;
-const int ROM_OFFSET   = 0x200; // 512
-const int MAX_ROM_SIZE = MEMORY_SIZE - ROM_OFFSET;
+#define OVERLAY_SCALE 2 // window pixels per overlay font pixel
 
-const SDL_Keycode MIN_COMMAND_KEY = SDLK_j;
-const SDL_Keycode MAX_COMMAND_KEY = SDLK_l;
-const int COMMAND_KEY_COUNT = MAX_COMMAND_KEY - MIN_COMMAND_KEY + 1;
-
-bool drawFlag = false;
 
+// Owned by the emulation thread once it has started
 bool currKeys[COMMAND_KEY_COUNT];
 bool prevKeys[COMMAND_KEY_COUNT];
 
-uint16_t opcode;
-uint8_t  memory[MEMORY_SIZE];
-uint8_t  registers[16];
-uint16_t I;
-uint16_t pc;
-
-uint8_t  gfx[SCREEN_WIDTH * SCREEN_HEIGHT];
-uint8_t  delay_timer;
-uint8_t  sound_timer;
-
-uint16_t stack[16];
-uint16_t sp;
+Emulator emu;
+Emulator snapshot; // the machine right after loading, for -w reloads
+size_t   romSize;
+char     keymap[16] = ROMDB_KEYS; // host key for each CHIP-8 key
+
+typedef struct {
+    EmuDisplay display;
+    uint32_t   tick; // emulated frames before this one was shown
+} Frame;
+
+// 3x5 glyphs for the metrics overlay, one row per byte, leftmost pixel in bit 2
+static const char    OVERLAY_CHARS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ./%:";
+static const uint8_t OVERLAY_FONT[][5] = {
+    {7,5,5,5,7}, {2,6,2,2,7}, {7,1,7,4,7}, {7,1,3,1,7}, {5,5,7,1,1}, // 0-4
+    {7,4,7,1,7}, {7,4,7,5,7}, {7,1,1,2,2}, {7,5,7,5,7}, {7,5,7,1,7}, // 5-9
+    {2,5,7,5,5}, {6,5,6,5,6}, {3,4,4,4,3}, {6,5,5,5,6}, {7,4,6,4,7}, // A-E
+    {7,4,6,4,4}, {3,4,5,5,3}, {5,5,7,5,5}, {7,2,2,2,7}, {1,1,1,5,2}, // F-J
+    {5,5,6,5,5}, {4,4,4,4,7}, {5,7,7,5,5}, {6,5,5,5,5}, {2,5,5,5,2}, // K-O
+    {6,5,6,4,4}, {2,5,5,6,3}, {6,5,6,5,5}, {3,4,2,1,6}, {7,2,2,2,2}, // P-T
+    {5,5,5,5,7}, {5,5,5,5,2}, {5,5,7,7,5}, {5,5,2,5,5}, {5,5,2,2,2}, // U-Y
+    {7,1,2,4,7}, {0,0,0,0,2}, {1,1,2,4,4}, {5,1,2,4,5}, {0,2,0,2,0}  // Z . / % :
+};
+
+// Colour per EmuDisplay_pixel index: off, plane 0, plane 1, both
+static const uint32_t PALETTE[1 << SCREEN_PLANES] = {
+    0xFF000000, 0xFFFFFFFF, 0xFF808080, 0xFFC0C0C0
+};
 
-uint8_t  key[16];
-uint8_t  keyValues[16] =
-   {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
-
-void preamble() {
-    debug_print("%04X: (%04X) ", pc, opcode);
-}
+/**
+ * Everything the render (main) thread and the emulation thread share.
+ * The settings are written before the emulation thread starts; after that
+ * the two only talk through the queue, the triple buffer and the atomics.
+ */
+typedef struct {
+    const char*  filename;
+    uint16_t     breakpoint;
+    bool         watch;   // reassemble and patch the ROM when the source is saved
+    bool         restore; // restart from the load snapshot on every reload
+    int          cyclesPerFrame;
+    Audio        audio;   // the emulation thread is the only producer
+
+    Input        input;   // key events, render thread -> emulation thread
+    Metrics      metrics; // emulation thread adds, render thread reports
+    TripleBuffer frames;  // Frame, emulation thread -> render thread
+    EmuPool      pool;    // filled before the emulation thread starts, read-only after
+    atomic_int   nextGame; // pool entry to start, render thread -> emulation thread; -1 for none
+    atomic_bool  quit;    // set by either thread to stop both
+    atomic_int   exitCode;
+} Machine;
 
 void printRegisters() {
     for (int i = 0; i < 16; i++) {
@@ -64,23 +100,16 @@ void printRegisters() {
     }
     puts("  I");
     for (int i = 0; i < 16; i++) {
-        printf("%04X ", registers[i]);
+        printf("%04X ", emu.registers[i]);
     }
-    printf("[%04X]\n", I);
+    printf("[%04X]\n", emu.I);
 }
 
 int getKeyIndex(SDL_Keycode key) {
-    if (key >= SDLK_0 && key <= SDLK_9) return key - SDLK_0;
-    if (key >= SDLK_a && key <= SDLK_f) return key - SDLK_a + SDLK_9 - SDLK_0 + 1;
-    return -1;
-}
-
-void clearDisplay() {
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
-            gfx[y * SCREEN_WIDTH + x] = 0;
-        }
+    for (int i = 0; i < 16; i++) {
+        if (keymap[i] == key) return i;
     }
+    return -1;
 }
 
 bool isDown(SDL_Keycode k) {
@@ -89,548 +118,742 @@ bool isDown(SDL_Keycode k) {
 }
 
 /**
- * Shortcut string equality, to be used only with string literals
- * for second argument.
+ * Assembles a source file, following INCLUDEs, and prints any error.
  */
-bool streq(const char* a, const char* b) {
-    return strncmp(a, b, strlen(b)) == 0;
+bool assemble(const char* filename, AsmRom* rom) {
+    if (!Asm_build(filename, NULL, rom)) {
+        const char* file = rom->errorFile[0] ? rom->errorFile : filename;
+        printf("%s:%u: %s\n", file, rom->errorLine, rom->error);
+        return false;
+    }
+    return true;
 }
 
-int main(int argc, const char* argv[]) {
-    const char* filename = "roms/bin/Maze.ch8";
-
-    uint16_t breakpoint;
-
-    if (argc > 1) {
-        for (int i = 0; i < argc - 1; i++) {
-            if (streq(argv[i], "-b") && i + 1 < argc) {
-                breakpoint = strtol(argv[i+1], NULL, 16);
-                printf("breakpoint set at 0x%04X\n", breakpoint);
-            }
-        }
-
-        filename = argv[argc-1];
+/**
+ * True if the running program can carry on with a new ROM of size bytes:
+ * pc and every return address on the stack still point into it.
+ */
+bool stateFits(size_t size) {
+    uint16_t end = ROM_OFFSET + size;
+    if (emu.pc < ROM_OFFSET || emu.pc >= end) return false;
+    for (int i = 1; i <= emu.sp; i++) { // stack[0] is never used; CALL pre-increments
+        if (emu.stack[i] < ROM_OFFSET || emu.stack[i] >= end) return false;
     }
+    return true;
+}
 
-    SDL_Window* window;
-    SDL_Surface* surface;
-    SDL_Init(SDL_INIT_VIDEO);
+/**
+ * Reassembles the source and patches it into the running machine. State
+ * is kept unless restore is set or it no longer fits the new code, in which
+ * case the load-time snapshot is restored.
+ */
+void reload(const char* filename, bool restore) {
+    AsmRom* assembled = malloc(sizeof(AsmRom));
+    if (!assemble(filename, assembled)) {
+        printf("Reload failed; still running the previous build\n");
+        free(assembled);
+        return;
+    }
 
-    printf("Window size: %dx%d\n", WINDOW_WIDTH, WINDOW_HEIGHT);
-    printf("Screen size: %dx%d\n", SCREEN_WIDTH, SCREEN_HEIGHT);
-    printf("Pixel size:  %dx%d\n", PIXEL_WIDTH, PIXEL_HEIGHT);
+    if (restore || !stateFits(assembled->size)) {
+        Emulator_copy(&emu, &snapshot);
+        printf("Reloaded %zu bytes, restarted from the load snapshot\n", assembled->size);
+    } else {
+        printf("Reloaded %zu bytes at pc 0x%04X\n", assembled->size, emu.pc);
+    }
+    Emulator_patchRom(&emu, assembled->bytes, assembled->size, romSize);
+    Emulator_patchRom(&snapshot, assembled->bytes, assembled->size, romSize);
+    romSize = assembled->size;
+    emu.drawFlag = true;
+    free(assembled);
+}
 
-    { // Initialize graphics stuff
-        window = SDL_CreateWindow(
-                "CHIP-8",
-                SDL_WINDOWPOS_UNDEFINED,
-                SDL_WINDOWPOS_UNDEFINED,
-                WINDOW_WIDTH,
-                WINDOW_HEIGHT,
-                SDL_WINDOW_ALLOW_HIGHDPI | SDL_RENDERER_PRESENTVSYNC
-            );
+/**
+ * Emulation thread: swaps in a pre-booted game from the pool, keeping the
+ * frontend's settings on the machine.
+ */
+void startGame(Machine* machine, int game) {
+    uint64_t start     = SDL_GetPerformanceCounter();
+    uint8_t  threshold = emu.tierThreshold;
+    bool     profiling = emu.profiling;
+
+    const EmuPoolEntry* entry = EmuPool_start(&machine->pool, game, &emu);
+    emu.tierThreshold = threshold;
+    emu.profiling     = profiling;
+    Emulator_copy(&snapshot, &emu);
+    romSize = entry->romSize;
+    machine->cyclesPerFrame = entry->settings.cyclesPerFrame;
+    memcpy(keymap, entry->settings.keymap, sizeof(keymap));
+
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    printf("Started %s in %.3f ms\n", entry->name, ms);
+}
 
-        if (window == NULL) {
-            printf("Couldn't create window\n");
-            return 1;
+/**
+ * Draws text in the overlay font with its top-left corner at (x, y), in
+ * window pixels, in the current draw colour. Unknown characters are blank.
+ */
+void drawOverlayText(SDL_Renderer* renderer, int x, int y, const char* text) {
+    for (; *text; text++, x += 4 * OVERLAY_SCALE) {
+        const char* found = strchr(OVERLAY_CHARS, *text);
+        if (*text == ' ' || found == NULL) continue;
+
+        const uint8_t* glyph = OVERLAY_FONT[found - OVERLAY_CHARS];
+        for (int row = 0; row < 5; row++) {
+            for (int col = 0; col < 3; col++) {
+                if (!(glyph[row] & (4 >> col))) continue;
+                SDL_Rect pixel = { x + col * OVERLAY_SCALE, y + row * OVERLAY_SCALE, OVERLAY_SCALE, OVERLAY_SCALE };
+                SDL_RenderFillRect(renderer, &pixel);
+            }
         }
+    }
+}
 
-        surface = SDL_GetWindowSurface(window);
+/**
+ * The last second's metrics in the top-left corner of the window.
+ */
+void drawOverlay(SDL_Renderer* renderer, const Metrics* metrics) {
+    char lines[4][48];
+    int  count = 1;
+    const MetricsReport* r = &metrics->report;
+    if (!metrics->hasReport) {
+        snprintf(lines[0], sizeof(lines[0]), "MEASURING...");
+    } else {
+        snprintf(lines[0], sizeof(lines[0]), "%.2f MIPS  EMU %u  FPS %u", r->mips, r->frames, r->hostFrames);
+        snprintf(lines[1], sizeof(lines[1]), "FRAME P50 %.1f  P99 %.1f", r->p50Ms, r->p99Ms);
+        snprintf(lines[2], sizeof(lines[2]), "MS/S RUN %.1f  DXYN %.1f", r->dispatchMs, r->drawMs);
+        snprintf(lines[3], sizeof(lines[3]), "MS/S PRESENT %.1f  EVENTS %.1f", r->presentMs, r->eventsMs);
+        count = 4;
     }
 
-    { // Initialize emulator
-        pc     = ROM_OFFSET; // Program counter starts at 0x200
-        opcode = 0;     // Reset current opcode
-        I      = 0;     // Reset index register
-        sp     = 0;     // Reset stack pointer
-
-        clearDisplay();
-        for (int i = 0; i < 16; i++) {
-            stack[i] = 0;
-        }
-        for (int i = 0; i < 16; i++) {
-            registers[i] = 0;
-        }
-        for (size_t i = 0; i < MEMORY_SIZE; i++) {
-            memory[i] = 0;
-        }
-        size_t count = 0;
-        for (size_t i = 0; i < CHIP8_FONT_SIZE; i++) {
-            memory[i] = CHIP8_FONT[i];
-            ++count;
-        }
-        printf("Loaded %ld bytes of font data\n", count);
+    int lineHeight = 7 * OVERLAY_SCALE;
+    SDL_Rect backing = { 0, 0, 0, count * lineHeight + OVERLAY_SCALE * 2 };
+    for (int i = 0; i < count; i++) {
+        int width = (int)strlen(lines[i]) * 4 * OVERLAY_SCALE + OVERLAY_SCALE * 3;
+        if (width > backing.w) backing.w = width;
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(renderer, &backing);
 
-        delay_timer = 0;
-        sound_timer = 0;
+    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+    for (int i = 0; i < count; i++) {
+        drawOverlayText(renderer, OVERLAY_SCALE * 2, OVERLAY_SCALE * 2 + i * lineHeight, lines[i]);
     }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); // SDL_RenderClear uses it too
+}
 
-    { // Load ROM
-        SDL_RWops* rom = SDL_RWFromFile(filename, "rb");
-        if (rom != NULL) {
-            int64_t size = SDL_RWsize(rom);
+/**
+ * Shortcut string equality, to be used only with string literals
+ * for second argument.
+ */
+bool streq(const char* a, const char* b) {
+    return strncmp(a, b, strlen(b)) == 0;
+}
 
-            if (size > MAX_ROM_SIZE) {
-                printf("ROM too big!\n");
-                return 1;
-            }
+void applyInput(InputEvent* event) {
+    SDL_Keycode k = event->key;
+    if (k >= MIN_COMMAND_KEY && k <= MAX_COMMAND_KEY) {
+        currKeys[k - MIN_COMMAND_KEY] = event->down;
+    }
 
-            uint8_t* data = memory + ROM_OFFSET;
+    int index = getKeyIndex(k);
+    if (index != -1) emu.key[index] = event->down;
+}
 
-            if (SDL_RWread(rom, data, size, 1) > 0) {
-                printf("Loaded %lld bytes of ROM data\n", size);
-            } else {
-                printf("Couldn't read file\n");
-            }
-            SDL_RWclose(rom);
-        } else {
-            printf("Couldn't open file\n");
-        }
+/**
+ * Runs the machine at SCREEN_FPS frames a second of cyclesPerFrame
+ * instructions each, independent of how fast frames are presented.
+ */
+int emulationThread(void* data) {
+    Machine* machine = data;
+
+    FileWatch sourceWatch;
+    uint32_t  lastWatchPoll = 0;
+    if (machine->watch) {
+        FileWatch_init(&sourceWatch, machine->filename);
+        printf("Watching %s for changes\n", machine->filename);
     }
 
-    bool running = true;
     bool infinite = false;
-    bool waitingForInput = false;
+    uint32_t tick = 0;
     uint32_t frameCount = 0;
+    uint32_t startTicks = SDL_GetTicks();
     bool breakpointTriggered = false;
 
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < COMMAND_KEY_COUNT; i++) {
         currKeys[i] = false;
         prevKeys[i] = false;
     }
 
-    while (running) {
-        for (int i = 0; i < COMMAND_KEY_COUNT; i++) {
-            prevKeys[i] = currKeys[i];
+    while (!atomic_load(&machine->quit)) {
+        int game = atomic_exchange(&machine->nextGame, -1);
+        if (game >= 0) {
+            startGame(machine, game);
+            infinite = false;
+            breakpointTriggered = false;
         }
 
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                running = false;
-                break;
+        Input_beginFrame(&machine->input, machine->cyclesPerFrame);
+        InputEvent event;
+
+        if (machine->watch && SDL_GetTicks() - lastWatchPoll >= WATCH_INTERVAL_MS) {
+            lastWatchPoll = SDL_GetTicks();
+            if (FileWatch_poll(&sourceWatch)) {
+                reload(machine->filename, machine->restore);
+                infinite = false;
+                breakpointTriggered = false;
+            }
+        }
+
+        uint32_t executed = 0;
+        uint64_t runTicks = 0;
+        for (int cycle = 0; cycle < machine->cyclesPerFrame && !infinite; ) { // run emulator
+            while (Input_next(&machine->input, cycle, &event)) {
+                applyInput(&event);
             }
 
-            if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
-                SDL_Keycode k = event.key.keysym.sym;
-                if (k >= MIN_COMMAND_KEY && k <= MAX_COMMAND_KEY) {
-                    currKeys[k - MIN_COMMAND_KEY] = (event.type == SDL_KEYDOWN);
+            uint16_t breakpoint = machine->breakpoint;
+            if ((breakpoint != 0 && emu.pc == breakpoint) || breakpointTriggered) {
+                if (!breakpointTriggered) printf("=== Breakpoint triggered at 0x%04X ===\n", emu.pc);
+
+                if (isDown(SDLK_k)) {
+                    breakpointTriggered = false;
+                } else {
+                    breakpointTriggered = true;
                 }
 
-                int index = getKeyIndex(k);
-                if (index == -1) continue;
-                key[index] = (event.type == SDL_KEYDOWN);
+                if (breakpointTriggered && !isDown(SDLK_j)) break;
+            }
+
+            // With no breakpoint to stop at, run up to the next key event in
+            // one go so Emulator_run can fuse instructions
+            int budget = 1;
+            if (breakpoint == 0 && !breakpointTriggered) {
+                int until = Input_nextCycle(&machine->input);
+                if (until > machine->cyclesPerFrame) until = machine->cyclesPerFrame;
+                if (until > cycle) budget = until - cycle;
+            }
+
+            int ran;
+            uint64_t runStart = SDL_GetPerformanceCounter();
+            EmuStatus status = Emulator_run(&emu, budget, &ran);
+            runTicks += SDL_GetPerformanceCounter() - runStart;
+            executed += ran;
+            cycle    += ran;
+            if (status == EMU_HALTED) {
+                printf("Infinite loop detected; stopping VM\n");
+                infinite = true;
+            } else if (status != EMU_OK) {
+                printf("%s: 0x%04X at 0x%04x\n", Emulator_statusName(status), emu.opcode, emu.pc);
+                atomic_store(&machine->exitCode, 1);
+                atomic_store(&machine->quit, true);
                 break;
             }
+
+            if (breakpointTriggered) break; // one instruction per step key press
         }
 
         if (isDown(SDLK_l)) {
             printRegisters();
         }
 
-        if (!infinite) { // run emulator
-            if ((breakpoint != 0 && pc == breakpoint) || breakpointTriggered) {
-                if (!breakpointTriggered) printf("=== Breakpoint triggered at 0x%04X ===\n", pc);
+        // Command key edges end here. Events the loop didn't reach (it stops
+        // early at a breakpoint or halt) are applied after, so their edges
+        // show up next frame
+        for (int i = 0; i < COMMAND_KEY_COUNT; i++) {
+            prevKeys[i] = currKeys[i];
+        }
+        while (Input_next(&machine->input, INPUT_FLUSH, &event)) {
+            applyInput(&event);
+        }
 
-                if (isDown(SDLK_k)) {
-                    breakpointTriggered = false;
-                } else {
-                    breakpointTriggered = true;
-                }
+        { // Timers and sound, paused along with the program at a breakpoint
+            if (!breakpointTriggered) Emulator_tickTimers(&emu);
+            Audio_tick(&machine->audio, emu.sound_timer > 0 && !breakpointTriggered);
+        }
 
-                if (breakpointTriggered && !isDown(SDLK_j)) continue;
-            }
+        Metrics_addEmulation(&machine->metrics, executed, runTicks, emu.drawNs);
+        emu.drawNs = 0;
+
+        if (emu.drawFlag) { // Hand the frame to the render thread
+            emu.drawFlag = false;
+            Frame* frame = TripleBuffer_writeBuffer(&machine->frames);
+            memcpy(&frame->display, &emu.display, sizeof(frame->display));
+            frame->tick = tick;
+            TripleBuffer_publish(&machine->frames);
+        }
+
+        ++tick;
+        ++frameCount;
+
+        // Sleep until the next frame is due; after a long stall, start
+        // counting again rather than racing to catch up
+        uint32_t due = startTicks + (uint32_t)((uint64_t)frameCount * 1000 / SCREEN_FPS);
+        uint32_t now = SDL_GetTicks();
+        if ((int32_t)(due - now) > 0) {
+            SDL_Delay(due - now);
+        } else if (now - due > 250) {
+            startTicks = now;
+            frameCount = 0;
+        }
+    }
+
+    if (machine->watch) FileWatch_close(&sourceWatch);
+    return 0;
+}
 
+/**
+ * Finds the ROM in filename in the library index dbName. Returns false,
+ * saying why, if it isn't there.
+ */
+static bool lookupRom(const char* dbName, const char* filename, RomDbEntry* found) {
+    RomDb db;
+    if (!RomDb_open(&db, dbName)) return false;
+
+    static uint8_t data[XO_MAX_ROM_SIZE];
+    size_t size = 0;
+    FILE*  in   = fopen(filename, "rb");
+    if (in != NULL) {
+        size = fread(data, 1, sizeof(data), in);
+        fclose(in);
+    }
 
-            opcode = memory[pc] << 8 | memory[pc + 1];
+    const RomDbEntry* entry = size > 0 ? RomDb_find(&db, RomDb_hash(data, size), size) : NULL;
+    if (entry != NULL) {
+        *found = *entry;
+        // romindex never writes a profile below the platform, but the file
+        // may not come from it
+        if (found->profile < found->platform) found->profile = found->platform;
+    } else {
+        printf("%s isn't in %s; using the defaults\n", filename, dbName);
+    }
+    RomDb_close(&db);
+    return entry != NULL;
+}
 
-            uint16_t addr = (opcode & 0x0FFF);
-            uint8_t  x    = (opcode & 0x0F00) >> 8;
-            uint8_t  y    = (opcode & 0x00F0) >> 4;
-            uint8_t  z    = (opcode & 0x000F);
-            uint8_t  yz   = (opcode & 0x00FF);
+static int compareNames(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
 
-            if (!waitingForInput) {
-                preamble();
+/**
+ * Pre-boots the ROMs in dir into the pool in name order, with the
+ * library's settings where it has them. -cpf still overrides the clock.
+ */
+static void fillPool(EmuPool* pool, const char* dir, const char* dbName, int cyclesPerFrame, bool cpfSet,
+                     int warmFrames) {
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        printf("Couldn't open directory %s\n", dir);
+        return;
+    }
+    char** names    = NULL;
+    int    count    = 0;
+    int    capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4) continue;
+        const char* ext = entry->d_name + len - 4;
+        if (strcasecmp(ext, ".ch8") != 0 && strcasecmp(ext, ".sc8") != 0 && strcasecmp(ext, ".xo8") != 0) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            names    = realloc(names, capacity * sizeof(char*));
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof(char*), compareNames);
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    if (count > 0 && EmuPool_init(pool, count)) {
+        for (int i = 0; i < count; i++) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+
+            RomDbEntry settings = { 0 };
+            settings.platform       = Emulator_guessPlatform(path);
+            settings.profile        = settings.platform;
+            settings.cyclesPerFrame = cyclesPerFrame;
+            memcpy(settings.keymap, ROMDB_KEYS, sizeof(settings.keymap));
+            if (dbName != NULL && lookupRom(dbName, path, &settings) && cpfSet) {
+                settings.cyclesPerFrame = cyclesPerFrame;
             }
+            EmuPool_add(pool, path, &settings, warmFrames);
+        }
+    } else if (count > 0) {
+        printf("Out of memory for %d games\n", count);
+    }
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
 
-            switch (opcode & 0xF000) {
-                case 0x0000: {
-                    switch (yz) {
-                        case 0x00E0: {
-                            debug_print("CLS\n");
-                            clearDisplay();
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x00EE: {
-                            debug_print("RET\n");
-                            pc = stack[sp];
-                            --sp;
-                            pc += 2;
-                        }
-                        break;
-
-                        default:
-                            printf("Unknown opcode: 0x%04X at 0x%04x\n", opcode, pc);
-                        return 1;
-                    }
-                }
-                break;
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    printf("Pooled %d games in %.1f ms; Page Down and Page Up switch between them\n", pool->count, ms);
+}
 
-                case 0x1000: {
-                    debug_print("JP   0x%04X\n", addr);
-                    if (addr == pc) {
-                        printf("Infinite loop detected; stopping VM\n");
-                        infinite = true;
-                    }
+/**
+ * Writes <prefix>.ppm and <prefix>.txt and prints the verdict.
+ */
+static void writeHeatmap(const EmuHeatmap* heatmap, size_t size, const char* prefix) {
+    char name[1024];
+    snprintf(name, sizeof(name), "%s.ppm", prefix);
+    EmuHeatmap_writePpm(heatmap, size, name);
+
+    snprintf(name, sizeof(name), "%s.txt", prefix);
+    FILE* report = fopen(name, "w");
+    if (report == NULL) {
+        printf("Couldn't create %s\n", name);
+        return;
+    }
+    EmuHeatmap_writeReport(heatmap, size, report);
+    fclose(report);
+    printf("Heatmap: %s.ppm and %s.txt, %u writes to code that had already run\n", prefix, prefix,
+           heatmap->smcWrites);
+}
 
-                    pc = addr;
-                }
-                break;
+int main(int argc, const char* argv[]) {
+    const char* filename = "roms/bin/Maze.ch8";
+    const char* recordName = NULL;
+    const char* metricsName = NULL;
+    const char* heatmapName = NULL;
+    const char* dbName      = NULL;
+    const char* poolDir     = NULL;
+    int         warmFrames  = 0;
+    ScaleFilter filter      = SCALE_NONE;
+    double      persistence = 0;
+    bool        cpfSet      = false;
+    bool        overlay     = false;
+    int         latencyMs = AUDIO_DEFAULT_MS;
+    int         tierThreshold = EMU_DEFAULT_TIER_THRESHOLD;
+    EmuPlatform platform;
+    bool        platformSet = false;
+
+    static Machine machine;
+    machine.breakpoint     = 0;
+    machine.watch          = false;
+    machine.restore        = false;
+    machine.cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
 
-                case 0x2000: {
-                    debug_print("CALL 0x%04X\n", addr);
-                    ++sp;
-                    stack[sp] = pc;
-                    pc = addr;
+    if (argc > 1) {
+        for (int i = 0; i < argc - 1; i++) {
+            if (streq(argv[i], "-b") && i + 1 < argc) {
+                machine.breakpoint = strtol(argv[i+1], NULL, 16);
+                printf("breakpoint set at 0x%04X\n", machine.breakpoint);
+            }
+            // streq matches prefixes, so -warm has to come before -w
+            else if (streq(argv[i], "-warm") && i + 1 < argc) {
+                warmFrames = atoi(argv[i+1]);
+            }
+            else if (streq(argv[i], "-w")) {
+                machine.watch = true;
+            }
+            else if (streq(argv[i], "-reset")) {
+                machine.restore = true;
+            }
+            else if (streq(argv[i], "-cpf") && i + 1 < argc) {
+                machine.cyclesPerFrame = atoi(argv[i+1]);
+                if (machine.cyclesPerFrame < 1) machine.cyclesPerFrame = 1;
+                cpfSet = true;
+            }
+            else if (streq(argv[i], "-latency") && i + 1 < argc) {
+                latencyMs = atoi(argv[i+1]);
+            }
+            else if (streq(argv[i], "-rec") && i + 1 < argc) {
+                recordName = argv[i+1];
+            }
+            else if (streq(argv[i], "-metrics") && i + 1 < argc) {
+                metricsName = argv[i+1];
+            }
+            else if (streq(argv[i], "-filter") && i + 1 < argc) {
+                if (!Scaler_parseFilter(argv[i+1], &filter)) {
+                    printf("Unknown filter %s; expected none, scale2x, epx, scale3x, scale4x, scanlines or lcd\n", argv[i+1]);
                 }
-                break;
-
-                case 0x3000: {
-                    debug_print("SE   V%X,\t%d\n", x, yz);
-                    if (registers[x] == yz) pc += 2;
-                    pc += 2;
+            }
+            else if (streq(argv[i], "-persist") && i + 1 < argc) {
+                persistence = atof(argv[i+1]);
+                if (persistence < 0 || persistence >= 1) {
+                    printf("Persistence %s out of range; expected 0 to below 1, e.g. 0.6\n", argv[i+1]);
+                    persistence = 0;
                 }
-                break;
+            }
+            else if (streq(argv[i], "-pool") && i + 1 < argc) {
+                poolDir = argv[i+1];
+            }
+            else if (streq(argv[i], "-db") && i + 1 < argc) {
+                dbName = argv[i+1];
+            }
+            else if (streq(argv[i], "-heatmap") && i + 1 < argc) {
+                heatmapName = argv[i+1];
+            }
+            else if (streq(argv[i], "-overlay")) {
+                overlay = true;
+            }
+            else if (streq(argv[i], "-tier") && i + 1 < argc) {
+                tierThreshold = atoi(argv[i+1]);
+                if (tierThreshold < 0)   tierThreshold = 0;
+                if (tierThreshold > 255) tierThreshold = 255;
+            }
+            else if (streq(argv[i], "-p") && i + 1 < argc) {
+                platformSet = Emulator_parsePlatform(argv[i+1], &platform);
+                if (!platformSet) printf("Unknown platform %s; expected chip8, schip or xochip\n", argv[i+1]);
+            }
+        }
 
-                case 0x4000: {
-                    debug_print("SNE  V%X,\t%d\n", x, yz);
-                    if (registers[x] != yz) pc += 2;
-                    pc += 2;
-                }
-                break;
+        filename = argv[argc-1];
+    }
+    machine.filename = filename;
+    if (!platformSet) platform = Emulator_guessPlatform(filename);
+
+    // Settings from the library, where the command line didn't give any
+    RomDbEntry tuned;
+    if (dbName != NULL && lookupRom(dbName, filename, &tuned)) {
+        if (!platformSet) platform = tuned.profile;
+        if (!cpfSet) machine.cyclesPerFrame = tuned.cyclesPerFrame;
+        memcpy(keymap, tuned.keymap, sizeof(keymap));
+        printf("Library: %s, %s quirks, %d cycles a frame, keys %.16s\n", Emulator_platformName(tuned.platform),
+               Emulator_platformName(platform), machine.cyclesPerFrame, keymap);
+    }
 
-                case 0x5000: {
-                    debug_print("SE   V%X,\tv%X\n", x, y);
-                    if (registers[x] == registers[y]) pc += 2;
-                    pc += 2;
-                }
+    SDL_Window*   window;
+    SDL_Renderer* renderer;
+    SDL_Texture*  texture;
+    static Scaler scaler;
+    Phosphor      phosphor = { 0 };
+    bool          vsync;
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
 
-                case 0x6000: {
-                    debug_print("LD   V%X,\t%d\n", x, yz);
-                    registers[x] = yz;
-                    pc += 2;
-                }
-                break;
+    printf("Window size: %dx%d\n", WINDOW_WIDTH, WINDOW_HEIGHT);
+    printf("Screen size: %dx%d\n", SCREEN_WIDTH, SCREEN_HEIGHT);
+    printf("Pixel size:  %dx%d\n", PIXEL_WIDTH, PIXEL_HEIGHT);
 
-                case 0x7000: {
-                    debug_print("ADD  V%X,\t%d\n", x, yz);
-                    registers[x] += yz;
-                    pc += 2;
-                }
-                break;
+    { // Initialize graphics stuff
+        window = SDL_CreateWindow(
+                "CHIP-8",
+                SDL_WINDOWPOS_UNDEFINED,
+                SDL_WINDOWPOS_UNDEFINED,
+                WINDOW_WIDTH,
+                WINDOW_HEIGHT,
+                SDL_WINDOW_ALLOW_HIGHDPI
+            );
 
-                case 0x8000: {
-                    switch (z) {
-                        case 0x0: {
-                            debug_print("LD   V%X,\tV%X\n", x, y);
-                            registers[x] = registers[y];
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x2: {
-                            debug_print("AND  V%X,\tV%X\n", x, y);
-                            registers[x] &= registers[y];
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x4: {
-                            debug_print("ADD  V%X,\tV%X\n", x, y);
-                            uint8_t  a = registers[x];
-                            uint8_t  b = registers[y];
-                            uint16_t c = a + b;
-                            registers[0xF] = c > 0xFF;
-                            registers[x]   = c & 0xFF;
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x5: {
-                            debug_print("SUB  V%X,\tV%X\n", x, y);
-                            registers[0xF] = registers[x] > registers[y];
-                            registers[x]  -= registers[y];
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x6: {
-                            debug_print("SHR  V%X,\t{V%X}\n", x, y);
-                            registers[0xF] = registers[x] % 0x1 == 1;
-                            registers[x]   = registers[x] >> 1;
-                            pc += 2;
-                        }
-                        break;
-
-                        default:
-                            printf("Unknown opcode: 0x%04X at 0x%04x\n", opcode, pc);
-                        return 1;
-                    }
-                }
-                break;
+        if (window == NULL) {
+            printf("Couldn't create window\n");
+            return 1;
+        }
 
-                case 0xA000: {
-                    I = opcode & 0x0FFF;
-                    debug_print("LD   I,\t%d\n", I);
-                    pc += 2;
-                }
-                break;
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if (renderer == NULL) renderer = SDL_CreateRenderer(window, -1, 0);
+        if (renderer == NULL) {
+            printf("Couldn't create renderer: %s\n", SDL_GetError());
+            return 1;
+        }
 
-                case 0xB000: {
-                    debug_print("JP   V0\t%d\n", addr);
-                    pc = addr + registers[0];
-                }
-                break;
+        // The screen is uploaded at hi-res size, low-res pixels doubled, or
+        // at the filter's multiple of it, and scaled the rest of the way by
+        // the GPU
+        if (!Scaler_init(&scaler, filter, PALETTE)) {
+            printf("Out of memory\n");
+            return 1;
+        }
+        if (persistence > 0 && !Phosphor_init(&phosphor, scaler.width, scaler.height, persistence)) {
+            printf("Out of memory\n");
+            return 1;
+        }
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                    scaler.width, scaler.height);
+        if (texture == NULL) {
+            printf("Couldn't create texture: %s\n", SDL_GetError());
+            return 1;
+        }
 
-                case 0xC000: {
-                    uint8_t rnd = rand() % 255;
-                    debug_print("RND  V%X,\t%d\n", x, yz);
-                    registers[x] = rnd & yz;
-                    pc += 2;
-                }
-                break;
+        SDL_RendererInfo info;
+        vsync = SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC);
+    }
 
-                case 0xD000: {
-                    uint16_t xpos = registers[x];
-                    uint16_t ypos = registers[y];
-                    uint16_t pixel;
-
-                    debug_print("DRW  V%X,\tV%X,\t%d\n", x, y, z);
-
-                    registers[0xF] = 0;
-                    for (int yline = 0; yline < z; ++yline) {
-                        pixel = memory[I + yline];
-                        for (int xline = 0; xline < 8; ++xline) {
-                            if ((pixel & (0x80 >> xline)) != 0) {
-                                if (gfx[(xpos + xline + ((ypos + yline) * 64))] == 1) {
-                                    registers[0xF] = 1;
-                                }
-                                gfx[xpos + xline + ((ypos + yline) * 64)] ^= 1;
-                            }
-                        }
-                    }
-
-                    drawFlag = true;
-                    pc += 2;
-                }
-                break;
+    { // Initialize emulator
+        if (!Emulator_init(&emu, platform) || !Emulator_init(&snapshot, platform)) {
+            printf("Out of memory\n");
+            return 1;
+        }
+        emu.tierThreshold = tierThreshold;
+        emu.profiling     = true; // for the metrics; the snapshot copies it
+        if (heatmapName != NULL) emu.heatmap = calloc(1, sizeof(EmuHeatmap));
+    }
 
-                case 0xE000: {
-                    switch (yz) {
-                        case 0x9E: {
-                            debug_print("SKP  V%X\n", x);
-                            if (registers[x] > 0xF) {
-                                printf("Invalid key index: %d\n", registers[x]);
-                                return 1;
-                            }
-
-                            if (key[registers[x]]) pc += 2;
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0xA1: {
-                            debug_print("SKNP V%X\n", x);
-                            if (registers[x] > 0xF) {
-                                printf("Invalid key index: %d\n", registers[x]);
-                                return 1;
-                            }
-
-                            if (!key[registers[x]]) pc += 2;
-                            pc += 2;
-                        }
-                        break;
-
-                        default:
-                            printf("Unknown opcode: 0x%04X at 0x%04x\n", opcode, pc);
-                            return 1;
-                    }
-                }
-                break;
+    { // Load ROM
+        size_t len = strlen(filename);
+        bool isSource = (len > 4 && strcmp(filename + len - 4, ".src") == 0) ||
+                        (len > 4 && strcmp(filename + len - 4, ".asm") == 0);
+
+        if (isSource) { // Assemble in process, following INCLUDEs
+            AsmRom* assembled = malloc(sizeof(AsmRom));
+            if (!assemble(filename, assembled)) return 1;
+            Emulator_loadRom(&emu, assembled->bytes, assembled->size);
+            romSize = assembled->size;
+            printf("Assembled %zu bytes of ROM data\n", assembled->size);
+            free(assembled);
+        } else {
+            SDL_RWops* rom = SDL_RWFromFile(filename, "rb");
+            if (rom != NULL) {
+                int64_t size = SDL_RWsize(rom);
 
-                case 0xF000: {
-                    switch (yz) {
-                        case 0x07: {
-                            debug_print("LD   V%X,\tDT\n", x);
-                            registers[x] = delay_timer;
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x0A: {
-                            if (waitingForInput) {
-                                for (int i = 0; i < 16; i++) {
-                                    if (key[i]) {
-                                        registers[x] = keyValues[i];
-                                        waitingForInput = false;
-                                        pc += 2;
-                                        break;
-                                    }
-                                }
-                            } else {
-                                debug_print("LD   V%X\tK\n", x);
-                                waitingForInput = true;
-                            }
-                        }
-                        break;
-
-                        case 0x15: {
-                            debug_print("LD   DT,\tV%X\n", x);
-                            delay_timer = registers[x];
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x18: {
-                            debug_print("LD   ST, V%X\n", x);
-                            sound_timer = registers[x];
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x1E: {
-                            debug_print("ADD  I\tV%X\n", x);
-                            I += registers[x];
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x29: {
-                            debug_print("LD   F, V%X\n", x);
-                            switch (registers[x]) {
-                                case 0x0: I =  0 * 5; break;
-                                case 0x1: I =  1 * 5; break;
-                                case 0x2: I =  2 * 5; break;
-                                case 0x3: I =  3 * 5; break;
-                                case 0x4: I =  4 * 5; break;
-                                case 0x5: I =  5 * 5; break;
-                                case 0x6: I =  6 * 5; break;
-                                case 0x7: I =  7 * 5; break;
-                                case 0x8: I =  8 * 5; break;
-                                case 0x9: I =  9 * 5; break;
-                                case 0xA: I = 10 * 5; break;
-                                case 0xB: I = 11 * 5; break;
-                                case 0xC: I = 12 * 5; break;
-                                case 0xD: I = 13 * 5; break;
-                                case 0xE: I = 14 * 5; break;
-                                case 0xF: I = 15 * 5; break;
-                                default:
-                                    printf("Invalid value for instruction Fx29: %d", x);
-                                    return 1;
-                            }
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x33: {
-                            debug_print("LD   B, V%X\n", x);
-                            memory[I]   = (registers[x] % 1000) / 100;
-                            memory[I+1] = (registers[x] % 100) / 10;
-                            memory[I+2] = (registers[x] % 10);
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x55: {
-                            debug_print("LD   [I]\tV%X\n", x);
-                            for (int i = 0; i <= x; ++i) {
-                                memory[I + i] = registers[i];
-                            }
-                            pc += 2;
-                        }
-                        break;
-
-                        case 0x65: {
-                            debug_print("LD   V%X\t[I]\n", x);
-                            for (int i = 0; i <= x; ++i) {
-                                registers[i] = memory[I + i];
-                            }
-                            pc += 2;
-                        }
-                        break;
-
-                        default:
-                            printf("Unknown opcode: 0x%04X at 0x%04x\n", opcode, pc);
-                            return 1;
-                    }
+                if (size > (int64_t)Emulator_maxRomSize(&emu)) {
+                    printf("ROM too big!\n");
+                    return 1;
                 }
-                break;
 
-                default:
-                    printf("Unknown opcode: 0x%04X at 0x%04x\n", opcode, pc);
-                    return 1;
-            }
+                uint8_t* data = malloc(size > 0 ? size : 1);
 
-            if (delay_timer > 0) {
-                --delay_timer;
+                if (SDL_RWread(rom, data, size, 1) > 0) {
+                    Emulator_loadRom(&emu, data, size);
+                    romSize = size;
+                    printf("Loaded %lld bytes of ROM data\n", (long long)size);
+                } else {
+                    printf("Couldn't read file\n");
+                }
+                free(data);
+                SDL_RWclose(rom);
+            } else {
+                printf("Couldn't open file\n");
             }
+        }
+
+        Emulator_copy(&snapshot, &emu);
+        if (machine.watch && !isSource) {
+            printf("-w needs a .asm or .src file\n");
+            machine.watch = false;
+        }
+    }
+
+    { // Pre-boot the games to switch between
+        atomic_init(&machine.nextGame, -1);
+        if (poolDir != NULL && machine.watch) {
+            printf("-pool can't be used with -w; not pooling\n");
+        } else if (poolDir != NULL && emu.heatmap != NULL) {
+            // One map would pile up every game's counts, sized by the last
+            printf("-pool can't be used with -heatmap; not pooling\n");
+        } else if (poolDir != NULL) {
+            fillPool(&machine.pool, poolDir, dbName, machine.cyclesPerFrame, cpfSet, warmFrames);
+        }
+    }
+
+    { // Start the emulation thread
+        if (!Metrics_init(&machine.metrics, metricsName)) return 1;
+        if (!Input_init(&machine.input) ||
+                !TripleBuffer_init(&machine.frames, sizeof(Frame))) {
+            printf("Out of memory\n");
+            return 1;
+        }
+        atomic_init(&machine.quit, false);
+        atomic_init(&machine.exitCode, 0);
+        Audio_init(&machine.audio, latencyMs);
+    }
+
+    static Recorder recorder;
+    bool recording = recordName != NULL && Recorder_open(&recorder, recordName);
+
+    SDL_Thread* emulation = SDL_CreateThread(emulationThread, "emulation", &machine);
+    if (emulation == NULL) {
+        printf("Couldn't start emulation thread: %s\n", SDL_GetError());
+        return 1;
+    }
 
-            if (sound_timer > 0) {
-                if (sound_timer == 1) {
-                    printf("BEEP!\n");
+    int      game = -1; // pool entry running; -1 while it's still the ROM from the command line
+    uint64_t lastPresent = SDL_GetPerformanceCounter();
+    while (!atomic_load(&machine.quit)) {
+        uint64_t eventsStart = SDL_GetPerformanceCounter();
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                atomic_store(&machine.quit, true);
+            }
+            else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_TAB) {
+                if (!event.key.repeat) overlay = !overlay;
+            }
+            else if (machine.pool.count > 0 && event.type == SDL_KEYDOWN &&
+                     (event.key.keysym.sym == SDLK_PAGEDOWN || event.key.keysym.sym == SDLK_PAGEUP)) {
+                if (event.key.repeat) continue;
+                int count = machine.pool.count;
+                if (event.key.keysym.sym == SDLK_PAGEDOWN) {
+                    game = (game + 1) % count;
+                } else {
+                    game = game <= 0 ? count - 1 : game - 1;
                 }
-                --sound_timer;
+                atomic_store(&machine.nextGame, game);
+                SDL_SetWindowTitle(window, machine.pool.entries[game].name);
+            }
+            else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat) {
+                // Dropped only if the emulator is a whole queue behind
+                Input_push(&machine.input, event.key.keysym.sym, event.type == SDL_KEYDOWN);
             }
         }
 
+        uint64_t eventsTicks = SDL_GetPerformanceCounter() - eventsStart;
+
         { // Update Graphics
-            // if (drawFlag || frameCount % 60 == 0) {
-            if (frameCount % 60 == 0) {
-                SDL_Rect pixel;
-                pixel.w = PIXEL_WIDTH;
-                pixel.h = PIXEL_HEIGHT;
-                uint32_t black = SDL_MapRGB(surface->format, 0, 0, 0);
-                uint32_t white = SDL_MapRGB(surface->format, 255, 255, 255);
-
-                for (int y = 0; y < SCREEN_HEIGHT; ++y) {
-                    for (int x = 0; x < SCREEN_WIDTH; ++x) {
-                        pixel.x = x * PIXEL_WIDTH;
-                        pixel.y = y * PIXEL_HEIGHT;
-                        if (!gfx[y * SCREEN_WIDTH + x]) {
-                            SDL_FillRect(surface, &pixel, black);
-                        } else {
-                            SDL_FillRect(surface, &pixel, white);
-                        }
-                    }
-                }
-                SDL_UpdateWindowSurface(window);
+            uint64_t presentStart = SDL_GetPerformanceCounter();
+            bool fresh;
+            const Frame* frame = TripleBuffer_read(&machine.frames, &fresh);
+            bool changed = false;
+            int  top = 0, bottom = 0;
+            if (fresh) {
+                if (recording) Recorder_push(&recorder, &frame->display, frame->tick);
+                changed = Scaler_update(&scaler, &frame->display, &top, &bottom);
             }
 
-            ++frameCount;
-            // if (frameCount % 60 == 0) {
-            //     printf("Test frame: \n");
-            //     for (int y = 0; y < SCREEN_HEIGHT; ++y) {
-            //         for (int x = 0; x < SCREEN_WIDTH; ++x) {
-            //             if (gfx[y * SCREEN_WIDTH + x]) {
-            //                 printf("X");
-            //             } else {
-            //                 printf(" ");
-            //             }
-            //         }
-            //         printf("\n");
-            //     }
-            // }
-        }
+            // Only the rows that changed are filtered and uploaded, unless
+            // there's persistence: then the whole picture is reblended every
+            // frame until what's fading has gone
+            double seconds = (double)(presentStart - lastPresent) / SDL_GetPerformanceFrequency();
+            lastPresent = presentStart;
+            if (phosphor.glow != NULL) {
+                if (Phosphor_update(&phosphor, scaler.pixels, changed, seconds)) {
+                    SDL_UpdateTexture(texture, NULL, phosphor.glow, scaler.width * sizeof(uint32_t));
+                }
+            } else if (changed) {
+                SDL_Rect rows = { 0, top, scaler.width, bottom - top };
+                SDL_UpdateTexture(texture, &rows, scaler.pixels + (size_t)top * scaler.width,
+                                  scaler.width * sizeof(uint32_t));
+            }
 
-        { // Set keys
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, texture, NULL, NULL);
+            if (overlay) drawOverlay(renderer, &machine.metrics);
+            uint64_t presentTicks = SDL_GetPerformanceCounter() - presentStart;
 
+            SDL_RenderPresent(renderer); // blocks until the next vblank when vsync is on
+            if (!vsync) SDL_Delay(1000 / SCREEN_FPS);
+            Metrics_addFrame(&machine.metrics, presentTicks, eventsTicks);
         }
     }
 
+    SDL_WaitThread(emulation, NULL);
+    Audio_close(&machine.audio);
+    Input_printStats(&machine.input);
+    printf("Tiers: %u blocks promoted, %u demoted\n", emu.promotions, emu.demotions);
+    if (emu.heatmap != NULL) {
+        writeHeatmap(emu.heatmap, (size_t)emu.memoryMask + 1, heatmapName);
+        free(emu.heatmap);
+    }
+    if (recording) {
+        Recorder_close(&recorder);
+        printf("Recorded %u frames (%llu bytes) to %s, %u dropped\n", recorder.written,
+               (unsigned long long)recorder.bytes, recordName, recorder.dropped);
+    }
+    Input_free(&machine.input);
+    Metrics_free(&machine.metrics);
+    TripleBuffer_free(&machine.frames);
+    Emulator_free(&emu);
+    Emulator_free(&snapshot);
+    EmuPool_free(&machine.pool);
+
+    SDL_DestroyTexture(texture);
+    Scaler_free(&scaler);
+    Phosphor_free(&phosphor);
+    SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
-    return 0;
-}
\ No newline at end of file
+    return atomic_load(&machine.exitCode);
+}
@@ -0,0 +1,890 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator.h"
+#include "opcodes.h"
+
+#define DEFAULT_CYCLES_PER_FRAME 10
+#define DEFAULT_FRAMES           3600 // a minute at TIMER_HZ
+#define DEFAULT_FUZZ_FRAMES      60
+#define FUZZ_PROGRAM_WORDS       256
+#define TABLE_TRIALS             200
+#define RANDOM_DRAWS             4096
+#define MAX_INPUT_EVENTS         4096
+
+/*
+ * Differential tester. Three modes:
+ *
+ *   lockstep  runs a ROM on the reference interpreter (Emulator_step, one
+ *             instruction at a time) and on Emulator_run, with the same
+ *             seed and input script, comparing the whole machine at least
+ *             every -every instructions. On a mismatch it bisects from the
+ *             last matching comparison to the first instruction after
+ *             which the two differ and prints both machines.
+ *   -fuzz N   does the same for N random programs.
+ *   -table    checks each CHIP-8 opcode on Emulator_step against the
+ *             reference semantics below, from random machine states.
+ */
+
+static uint32_t nextRandom(uint32_t* state) { // xorshift32
+    uint32_t r = *state;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    return *state = r;
+}
+
+typedef struct {
+    uint32_t frame;
+    uint8_t  key;
+    bool     down;
+} InputEvent;
+
+/**
+ * Reads a script of "<frame> <key> down|up" lines, key in hex, frames in
+ * order. # starts a comment.
+ */
+static int readInputScript(const char* filename, InputEvent* events, int max) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Couldn't open %s\n", filename);
+        return -1;
+    }
+
+    int  count = 0;
+    int  lineNo = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        lineNo++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        unsigned frame, key;
+        char     state[8];
+        int      fields = sscanf(line, "%u %x %7s", &frame, &key, state);
+        if (fields <= 0) continue;
+        if (fields != 3 || key > 0xF || (strcmp(state, "down") != 0 && strcmp(state, "up") != 0) ||
+                (count > 0 && frame < events[count-1].frame) || count == max) {
+            printf("%s:%d: expected \"<frame> <key> down|up\", frames in order\n", filename, lineNo);
+            fclose(file);
+            return -1;
+        }
+        events[count].frame = frame;
+        events[count].key   = key;
+        events[count].down  = strcmp(state, "down") == 0;
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+//
+// Lockstep
+//
+
+typedef struct {
+    Emulator ref;       // Emulator_step
+    Emulator fast;      // Emulator_run
+    Emulator refMark;   // both machines at the last comparison that matched
+    Emulator fastMark;
+    Emulator probeRef;  // bisection scratch
+    Emulator probeFast;
+    const char* name;    // what is being run, for the report
+    uint64_t    cycle;   // instructions run by the reference so far
+    EmuStatus   stopped; // what both machines stopped at, if they did
+} Lockstep;
+
+static bool Lockstep_init(Lockstep* ls, EmuPlatform platform) {
+    return Emulator_init(&ls->ref, platform)     && Emulator_init(&ls->fast, platform) &&
+           Emulator_init(&ls->refMark, platform) && Emulator_init(&ls->fastMark, platform) &&
+           Emulator_init(&ls->probeRef, platform) && Emulator_init(&ls->probeFast, platform);
+}
+
+static void Lockstep_free(Lockstep* ls) {
+    Emulator_free(&ls->ref);
+    Emulator_free(&ls->fast);
+    Emulator_free(&ls->refMark);
+    Emulator_free(&ls->fastMark);
+    Emulator_free(&ls->probeRef);
+    Emulator_free(&ls->probeFast);
+}
+
+// Both count the instruction that stopped them, as Emulator_run does
+static int stepRef(Emulator* emu, int cycles, EmuStatus* status) {
+    int ran = 0;
+    *status = EMU_OK;
+    while (ran < cycles && *status == EMU_OK) {
+        *status = Emulator_step(emu);
+        ran++;
+    }
+    return ran;
+}
+
+static int runFast(Emulator* emu, int cycles, EmuStatus* status) {
+    int ran;
+    *status = Emulator_run(emu, cycles, &ran);
+    return ran;
+}
+
+/**
+ * Everything a program can observe or leave behind. The tier tables and
+ * counters are the fast backend's own business and are left out.
+ */
+static bool sameState(const Emulator* a, const Emulator* b) {
+    return a->pc == b->pc && a->I == b->I && a->opcode == b->opcode &&
+           memcmp(a->registers, b->registers, sizeof(a->registers)) == 0 &&
+           a->sp == b->sp && memcmp(a->stack, b->stack, sizeof(a->stack)) == 0 &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           a->waitingForInput == b->waitingForInput && a->drawFlag == b->drawFlag &&
+           a->planes == b->planes && a->pitch == b->pitch && a->rng == b->rng &&
+           memcmp(a->flags, b->flags, sizeof(a->flags)) == 0 &&
+           memcmp(a->audioPattern, b->audioPattern, sizeof(a->audioPattern)) == 0 &&
+           memcmp(&a->display, &b->display, sizeof(a->display)) == 0 &&
+           memcmp(a->memory, b->memory, a->memoryMask + 1) == 0;
+}
+
+static void printRow(const char* name, unsigned a, unsigned b, int digits) {
+    char left[16], right[16];
+    snprintf(left, sizeof(left), "0x%0*X", digits, a);
+    snprintf(right, sizeof(right), "0x%0*X", digits, b);
+    printf("  %-8s %-10s %s%s\n", name, left, right, a != b ? "  <" : "");
+}
+
+/**
+ * Both machines side by side, differences marked.
+ */
+static void printStates(const Emulator* a, const Emulator* b) {
+    printf("  %-8s %-10s %s\n", "", "ref", "fast");
+    printRow("pc", a->pc, b->pc, 4);
+    printRow("opcode", a->opcode, b->opcode, 4);
+    printRow("I", a->I, b->I, 4);
+    for (int i = 0; i < 16; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "V%X", i);
+        printRow(name, a->registers[i], b->registers[i], 2);
+    }
+    printRow("sp", a->sp, b->sp, 2);
+    for (int i = 0; i < STACK_SIZE; i++) {
+        if (a->stack[i] == b->stack[i] && i > a->sp && i > b->sp) continue;
+        char name[16];
+        snprintf(name, sizeof(name), "stack[%d]", i);
+        printRow(name, a->stack[i], b->stack[i], 4);
+    }
+    printRow("DT", a->delay_timer, b->delay_timer, 2);
+    printRow("ST", a->sound_timer, b->sound_timer, 2);
+    if (a->waitingForInput != b->waitingForInput) printRow("waiting", a->waitingForInput, b->waitingForInput, 1);
+    if (a->planes != b->planes) printRow("planes", a->planes, b->planes, 1);
+    if (a->rng != b->rng) printRow("rng", a->rng, b->rng, 8);
+
+    int shown = 0;
+    for (int addr = 0; addr <= a->memoryMask; addr++) {
+        if (a->memory[addr] == b->memory[addr]) continue;
+        if (shown++ < 8) {
+            char name[16];
+            snprintf(name, sizeof(name), "[%04X]", addr);
+            printRow(name, a->memory[addr], b->memory[addr], 2);
+        }
+    }
+    if (shown > 8) printf("  ... %d more bytes of memory differ\n", shown - 8);
+
+    int pixels = 0;
+    int firstX = 0, firstY = 0;
+    for (int y = 0; y < HIRES_HEIGHT; y++) {
+        for (int x = 0; x < HIRES_WIDTH; x++) {
+            if (EmuDisplay_pixel(&a->display, x, y) == EmuDisplay_pixel(&b->display, x, y)) continue;
+            if (pixels++ == 0) { firstX = x; firstY = y; }
+        }
+    }
+    if (a->display.hires != b->display.hires) printRow("hires", a->display.hires, b->display.hires, 1);
+    if (pixels > 0) printf("  %d pixels differ, the first at (%d, %d)\n", pixels, firstX, firstY);
+}
+
+/**
+ * Disassembles the instructions around pc.
+ */
+static void printCode(const Emulator* emu, uint16_t pc) {
+    for (int offset = -6; offset <= 6; offset += 2) {
+        uint16_t addr   = (pc + offset) & emu->memoryMask;
+        uint16_t opcode = emu->memory[addr] << 8 | emu->memory[(addr + 1) & emu->memoryMask];
+        char     line[64];
+        Opcode_format(line, sizeof(line), opcode, NULL);
+        printf("%s 0x%04X  %04X  %s\n", offset == 0 ? ">" : " ", addr, opcode, line);
+    }
+}
+
+/**
+ * Reruns both machines count instructions from the marks into the probes.
+ * Returns true if they end up different.
+ */
+static bool probe(Lockstep* ls, int count, EmuStatus* refStatus, EmuStatus* fastStatus) {
+    Emulator_copy(&ls->probeRef, &ls->refMark);
+    Emulator_copy(&ls->probeFast, &ls->fastMark);
+    int refRan  = stepRef(&ls->probeRef, count, refStatus);
+    int fastRan = runFast(&ls->probeFast, count, fastStatus);
+    return refRan != fastRan || *refStatus != *fastStatus || !sameState(&ls->probeRef, &ls->probeFast);
+}
+
+/**
+ * Finds and prints the first instruction after the marks where the machines
+ * part, given that they have parted within cycles instructions.
+ */
+static void reportDivergence(Lockstep* ls, int cycles) {
+    EmuStatus refStatus, fastStatus;
+
+    // Smallest count that differs. The fast backend runs with a smaller
+    // budget on each probe, which can change what it fuses; if no smaller
+    // budget reproduces the mismatch, report the whole stretch
+    int lo = 1, hi = cycles, found = 0;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (probe(ls, mid, &refStatus, &fastStatus)) {
+            found = mid;
+            hi    = mid - 1;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    if (found == 0) {
+        printf("Diverged within instructions %llu-%llu, only with the full budget of %d\n",
+               (unsigned long long)ls->cycle + 1, (unsigned long long)ls->cycle + cycles, cycles);
+        printStates(&ls->ref, &ls->fast);
+        return;
+    }
+
+    probe(ls, found - 1, &refStatus, &fastStatus);
+    uint16_t pc = ls->probeRef.pc;
+    printf("Diverged at instruction %llu, at 0x%04X:\n", (unsigned long long)ls->cycle + found, pc);
+    printCode(&ls->probeRef, pc);
+
+    probe(ls, found, &refStatus, &fastStatus);
+    printf("After it (ref %s, fast %s):\n", Emulator_statusName(refStatus), Emulator_statusName(fastStatus));
+    printStates(&ls->probeRef, &ls->probeFast);
+}
+
+/**
+ * Runs both machines for frames frames, applying events at the start of
+ * their frame. Returns false at the first divergence, after reporting it.
+ * A halt or error that both machines agree on ends the run early, and is
+ * left in ls->stopped.
+ */
+static bool runLockstep(Lockstep* ls, int frames, int cyclesPerFrame, int every,
+                        const InputEvent* events, int eventCount) {
+    int next = 0;
+    ls->cycle   = 0;
+    ls->stopped = EMU_OK;
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (; next < eventCount && events[next].frame <= (uint32_t)frame; next++) {
+            ls->ref.key[events[next].key]  = events[next].down;
+            ls->fast.key[events[next].key] = events[next].down;
+        }
+
+        for (int done = 0; done < cyclesPerFrame; ) {
+            int chunk = cyclesPerFrame - done;
+            if (chunk > every) chunk = every;
+
+            Emulator_copy(&ls->refMark, &ls->ref);
+            Emulator_copy(&ls->fastMark, &ls->fast);
+
+            EmuStatus refStatus, fastStatus;
+            int refRan  = stepRef(&ls->ref, chunk, &refStatus);
+            int fastRan = runFast(&ls->fast, chunk, &fastStatus);
+            if (refRan != fastRan || refStatus != fastStatus || !sameState(&ls->ref, &ls->fast)) {
+                printf("%s, frame %d: ", ls->name, frame);
+                reportDivergence(ls, chunk);
+                return false;
+            }
+            ls->cycle += refRan;
+            done      += refRan;
+
+            if (refStatus != EMU_OK) {
+                ls->stopped = refStatus;
+                return true;
+            }
+        }
+
+        Emulator_tickTimers(&ls->ref);
+        Emulator_tickTimers(&ls->fast);
+    }
+    return true;
+}
+
+//
+// Fuzzing
+//
+
+/**
+ * A random instruction the disassembler knows, with jump targets kept
+ * inside the program so it runs for a while.
+ */
+static uint16_t randomOpcode(uint32_t* rng, int words) {
+    for (;;) {
+        uint16_t opcode = nextRandom(rng) & 0xFFFF;
+        switch (Opcode_kind(opcode)) {
+            case OP_UNKNOWN:
+            case OP_LD_I_LONG: // its operand word would be random too
+                continue;
+            case OP_JP:
+            case OP_CALL:
+            case OP_JP_V0:
+                return (opcode & 0xF000) | (ROM_OFFSET + 2 * (nextRandom(rng) % words));
+            default:
+                return opcode;
+        }
+    }
+}
+
+/**
+ * Fills program with random instructions, a quarter of the time starting
+ * one of the sequences Emulator_run fuses.
+ */
+static void randomProgram(uint32_t* rng, uint8_t* program, int words) {
+    int i = 0;
+    while (i < words) {
+        uint16_t seq[3];
+        int      length = 1;
+        uint8_t  x = nextRandom(rng) & 0xF;
+        uint8_t  y = nextRandom(rng) & 0xF;
+        switch (nextRandom(rng) % 16) {
+            case 0: // LD I, nnn / DRW
+                seq[0] = 0xA000 | (nextRandom(rng) & 0xFFF);
+                seq[1] = 0xD000 | x << 8 | y << 4 | (nextRandom(rng) & 0xF);
+                length = 2;
+                break;
+            case 1: // LD Vx, kk / LD Vy, kk
+                seq[0] = 0x6000 | x << 8 | (nextRandom(rng) & 0xFF);
+                seq[1] = 0x6000 | y << 8 | (nextRandom(rng) & 0xFF);
+                length = 2;
+                break;
+            case 2: // ADD I, Vx / LD Vy, [I]
+                seq[0] = 0xF01E | x << 8;
+                seq[1] = 0xF065 | y << 8;
+                length = 2;
+                break;
+            case 3: // LD Vx, DT / SE Vx, 0 / JP back
+                seq[0] = 0xF007 | x << 8;
+                seq[1] = 0x3000 | x << 8;
+                seq[2] = 0x1000 | (ROM_OFFSET + 2 * i);
+                length = 3;
+                break;
+            default:
+                seq[0] = randomOpcode(rng, words);
+                break;
+        }
+        for (int j = 0; j < length && i < words; j++, i++) {
+            program[2 * i]     = seq[j] >> 8;
+            program[2 * i + 1] = seq[j] & 0xFF;
+        }
+    }
+}
+
+static int fuzz(EmuPlatform platform, int cases, uint32_t seed, int cyclesPerFrame, int frames) {
+    static Lockstep   ls;
+    static InputEvent events[DEFAULT_FUZZ_FRAMES * 4];
+    if (!Lockstep_init(&ls, platform)) {
+        printf("Out of memory\n");
+        return 2;
+    }
+
+    int failures = 0;
+    for (int c = 0; c < cases; c++) {
+        uint32_t caseSeed = seed + c;
+        uint32_t rng      = caseSeed * 2654435761u | 1;
+
+        uint8_t program[FUZZ_PROGRAM_WORDS * 2];
+        randomProgram(&rng, program, FUZZ_PROGRAM_WORDS);
+        Emulator_reset(&ls.ref, platform);
+        Emulator_seed(&ls.ref, caseSeed);
+        Emulator_loadRom(&ls.ref, program, sizeof(program));
+        for (int i = 0; i < 16; i++) {
+            ls.ref.registers[i] = nextRandom(&rng);
+        }
+        ls.ref.I           = nextRandom(&rng) & 0xFFF;
+        ls.ref.delay_timer = nextRandom(&rng) % 8;
+        Emulator_copy(&ls.fast, &ls.ref);
+
+        static const uint8_t THRESHOLDS[] = { 0, 1, 2, EMU_DEFAULT_TIER_THRESHOLD };
+        ls.fast.tierThreshold = THRESHOLDS[nextRandom(&rng) % sizeof(THRESHOLDS)];
+
+        int eventCount = 0;
+        int maxEvents  = (int)(sizeof(events) / sizeof(events[0]));
+        for (int frame = 0; frame < frames && eventCount < maxEvents; frame++) {
+            if (nextRandom(&rng) % 4 != 0) continue;
+            events[eventCount].frame = frame;
+            events[eventCount].key   = nextRandom(&rng) & 0xF;
+            events[eventCount].down  = nextRandom(&rng) & 1;
+            eventCount++;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "Case %d (seed %u, tier %u)", c, caseSeed, ls.fast.tierThreshold);
+        ls.name = name;
+        if (!runLockstep(&ls, frames, cyclesPerFrame, cyclesPerFrame, events, eventCount)) failures++;
+    }
+
+    printf("%d of %d fuzz cases diverged\n", failures, cases);
+    Lockstep_free(&ls);
+    return failures > 0;
+}
+
+//
+// Reference table
+//
+
+/**
+ * The CHIP-8 machine as the reference semantics see it. The stack follows
+ * the interpreter's layout (CALL pre-increments sp, stack[0] unused) so the
+ * two compare directly.
+ */
+typedef struct {
+    uint8_t  V[16];
+    uint16_t I;
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t stack[STACK_SIZE];
+    uint8_t  dt;
+    uint8_t  st;
+    uint8_t  keys[16];
+    uint8_t  memory[MEMORY_SIZE];
+    uint8_t  screen[SCREEN_HEIGHT][SCREEN_WIDTH];
+} RefState;
+
+/**
+ * Executes one instruction the way the COSMAC VIP interpreter does, which
+ * is what PLATFORM_CHIP8 follows. Returns false for an undefined opcode.
+ * Only the operand values the spec defines are used: SKP, SKNP and LD F
+ * keys below 0x10, and memory accesses within MEMORY_SIZE.
+ */
+static bool refExecute(RefState* s, uint16_t op) {
+    uint8_t  x   = (op >> 8) & 0xF;
+    uint8_t  y   = (op >> 4) & 0xF;
+    uint8_t  n   = op & 0xF;
+    uint8_t  kk  = op & 0xFF;
+    uint16_t nnn = op & 0xFFF;
+    uint16_t next = s->pc + 2;
+
+    switch (op >> 12) {
+        case 0x0:
+            if (op == 0x00E0) {
+                memset(s->screen, 0, sizeof(s->screen));
+            } else if (op == 0x00EE) {
+                next  = s->stack[s->sp] + 2;
+                s->sp = (s->sp - 1) & STACK_MASK;
+            } else {
+                return false;
+            }
+            break;
+        case 0x1: next = nnn; break;
+        case 0x2:
+            s->sp = (s->sp + 1) & STACK_MASK;
+            s->stack[s->sp] = s->pc;
+            next = nnn;
+            break;
+        case 0x3: if (s->V[x] == kk) next += 2; break;
+        case 0x4: if (s->V[x] != kk) next += 2; break;
+        case 0x5:
+            if (n != 0) return false;
+            if (s->V[x] == s->V[y]) next += 2;
+            break;
+        case 0x6: s->V[x] = kk; break;
+        case 0x7: s->V[x] += kk; break;
+        case 0x8: {
+            uint8_t vx = s->V[x], vy = s->V[y];
+            switch (n) {
+                case 0x0: s->V[x] = vy; break;
+                case 0x1: s->V[x] = vx | vy; s->V[0xF] = 0; break;
+                case 0x2: s->V[x] = vx & vy; s->V[0xF] = 0; break;
+                case 0x3: s->V[x] = vx ^ vy; s->V[0xF] = 0; break;
+                case 0x4: s->V[x] = vx + vy; s->V[0xF] = vx + vy > 0xFF; break;
+                case 0x5: s->V[x] = vx - vy; s->V[0xF] = vx >= vy; break;
+                case 0x6: s->V[x] = vy >> 1; s->V[0xF] = vy & 1; break;
+                case 0x7: s->V[x] = vy - vx; s->V[0xF] = vy >= vx; break;
+                case 0xE: s->V[x] = vy << 1; s->V[0xF] = vy >> 7; break;
+                default: return false;
+            }
+            break;
+        }
+        case 0x9:
+            if (n != 0) return false;
+            if (s->V[x] != s->V[y]) next += 2;
+            break;
+        case 0xA: s->I = nnn; break;
+        case 0xB: next = nnn + s->V[0]; break;
+        case 0xC: break; // checked by the caller; the value is the interpreter's to pick
+        case 0xD: {
+            bool collided = false;
+            int  left = s->V[x] % SCREEN_WIDTH;
+            int  top  = s->V[y] % SCREEN_HEIGHT;
+            for (int row = 0; row < n && top + row < SCREEN_HEIGHT; row++) {
+                uint8_t bits = s->memory[(s->I + row) % MEMORY_SIZE];
+                for (int col = 0; col < 8 && left + col < SCREEN_WIDTH; col++) {
+                    if (!(bits & (0x80 >> col))) continue;
+                    uint8_t* pixel = &s->screen[top + row][left + col];
+                    if (*pixel) collided = true;
+                    *pixel ^= 1;
+                }
+            }
+            s->V[0xF] = collided;
+            break;
+        }
+        case 0xE:
+            if (kk == 0x9E) {
+                if (s->keys[s->V[x] & 0xF]) next += 2;
+            } else if (kk == 0xA1) {
+                if (!s->keys[s->V[x] & 0xF]) next += 2;
+            } else {
+                return false;
+            }
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x07: s->V[x] = s->dt; break;
+                case 0x0A: { // the lowest key held, or try again
+                    next = s->pc;
+                    for (int k = 0; k < 16; k++) {
+                        if (s->keys[k]) {
+                            s->V[x] = k;
+                            next    = s->pc + 2;
+                            break;
+                        }
+                    }
+                    break;
+                }
+                case 0x15: s->dt = s->V[x]; break;
+                case 0x18: s->st = s->V[x]; break;
+                case 0x1E: s->I += s->V[x]; break;
+                case 0x29: s->I = (s->V[x] & 0xF) * 5; break;
+                case 0x33:
+                    s->memory[s->I % MEMORY_SIZE]       = s->V[x] / 100;
+                    s->memory[(s->I + 1) % MEMORY_SIZE] = s->V[x] / 10 % 10;
+                    s->memory[(s->I + 2) % MEMORY_SIZE] = s->V[x] % 10;
+                    break;
+                case 0x55:
+                    for (int i = 0; i <= x; i++) s->memory[(s->I + i) % MEMORY_SIZE] = s->V[i];
+                    s->I += x + 1;
+                    break;
+                case 0x65:
+                    for (int i = 0; i <= x; i++) s->V[i] = s->memory[(s->I + i) % MEMORY_SIZE];
+                    s->I += x + 1;
+                    break;
+                default: return false;
+            }
+            break;
+    }
+    s->pc = next;
+    return true;
+}
+
+static void toEmulator(const RefState* s, Emulator* emu) {
+    Emulator_reset(emu, PLATFORM_CHIP8);
+    memcpy(emu->registers, s->V, sizeof(s->V));
+    emu->I  = s->I;
+    emu->pc = s->pc;
+    emu->sp = s->sp;
+    memcpy(emu->stack, s->stack, sizeof(s->stack));
+    emu->delay_timer = s->dt;
+    emu->sound_timer = s->st;
+    memcpy(emu->key, s->keys, sizeof(s->keys));
+    memcpy(emu->memory, s->memory, MEMORY_SIZE);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            if (s->screen[y][x]) emu->display.rows[0][y][0] |= 1ULL << (63 - x);
+        }
+    }
+}
+
+static void fromEmulator(const Emulator* emu, RefState* s) {
+    memcpy(s->V, emu->registers, sizeof(s->V));
+    s->I  = emu->I;
+    s->pc = emu->pc;
+    s->sp = emu->sp;
+    memcpy(s->stack, emu->stack, sizeof(s->stack));
+    s->dt = emu->delay_timer;
+    s->st = emu->sound_timer;
+    memcpy(s->keys, emu->key, sizeof(s->keys));
+    memcpy(s->memory, emu->memory, MEMORY_SIZE);
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            s->screen[y][x] = EmuDisplay_pixel(&emu->display, x, y) & 1;
+        }
+    }
+}
+
+/**
+ * Describes the first few differences between what the reference expects
+ * and what the interpreter did.
+ */
+static void describeDifference(const RefState* want, const RefState* got, char* buf, size_t size) {
+    int length = 0;
+    int found  = 0;
+#define DIFF(...) \
+    do { if (found++ < 3 && length < (int)size) length += snprintf(buf + length, size - length, __VA_ARGS__); } while (0)
+
+    if (want->pc != got->pc) DIFF(" pc want %04X got %04X;", want->pc, got->pc);
+    for (int i = 0; i < 16; i++) {
+        if (want->V[i] != got->V[i]) DIFF(" V%X want %02X got %02X;", i, want->V[i], got->V[i]);
+    }
+    if (want->I != got->I)   DIFF(" I want %04X got %04X;", want->I, got->I);
+    if (want->sp != got->sp) DIFF(" sp want %d got %d;", want->sp, got->sp);
+    if (memcmp(want->stack, got->stack, sizeof(want->stack)) != 0) DIFF(" stack differs;");
+    if (want->dt != got->dt) DIFF(" DT want %02X got %02X;", want->dt, got->dt);
+    if (want->st != got->st) DIFF(" ST want %02X got %02X;", want->st, got->st);
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (want->memory[addr] != got->memory[addr]) {
+            DIFF(" [%03X] want %02X got %02X;", addr, want->memory[addr], got->memory[addr]);
+            break;
+        }
+    }
+    if (memcmp(want->screen, got->screen, sizeof(want->screen)) != 0) DIFF(" screen differs;");
+#undef DIFF
+}
+
+typedef struct {
+    const char* pattern;
+    uint16_t    base;
+    uint16_t    fixed;   // bits of base that stay; the rest are random operands
+    bool        keyVx;   // Vx is a key or digit, 0-F
+} TableRow;
+
+static const TableRow TABLE[] = {
+    { "00E0", 0x00E0, 0xFFFF, false }, { "00EE", 0x00EE, 0xFFFF, false },
+    { "1nnn", 0x1000, 0xF000, false }, { "2nnn", 0x2000, 0xF000, false },
+    { "3xkk", 0x3000, 0xF000, false }, { "4xkk", 0x4000, 0xF000, false },
+    { "5xy0", 0x5000, 0xF00F, false }, { "6xkk", 0x6000, 0xF000, false },
+    { "7xkk", 0x7000, 0xF000, false }, { "8xy0", 0x8000, 0xF00F, false },
+    { "8xy1", 0x8001, 0xF00F, false }, { "8xy2", 0x8002, 0xF00F, false },
+    { "8xy3", 0x8003, 0xF00F, false }, { "8xy4", 0x8004, 0xF00F, false },
+    { "8xy5", 0x8005, 0xF00F, false }, { "8xy6", 0x8006, 0xF00F, false },
+    { "8xy7", 0x8007, 0xF00F, false }, { "8xyE", 0x800E, 0xF00F, false },
+    { "9xy0", 0x9000, 0xF00F, false }, { "Annn", 0xA000, 0xF000, false },
+    { "Bnnn", 0xB000, 0xF000, false }, { "Cxkk", 0xC000, 0xF000, false },
+    { "Dxyn", 0xD000, 0xF000, false }, { "Ex9E", 0xE09E, 0xF0FF, true  },
+    { "ExA1", 0xE0A1, 0xF0FF, true  }, { "Fx07", 0xF007, 0xF0FF, false },
+    { "Fx0A", 0xF00A, 0xF0FF, false }, { "Fx15", 0xF015, 0xF0FF, false },
+    { "Fx18", 0xF018, 0xF0FF, false }, { "Fx1E", 0xF01E, 0xF0FF, false },
+    { "Fx29", 0xF029, 0xF0FF, true  }, { "Fx33", 0xF033, 0xF0FF, false },
+    { "Fx55", 0xF055, 0xF0FF, false }, { "Fx65", 0xF065, 0xF0FF, false },
+};
+
+/**
+ * A random machine about to run opcode. Below ROM_OFFSET, memory is low,
+ * what Emulator_reset puts there.
+ */
+static void randomState(uint32_t* rng, RefState* s, uint16_t opcode, bool keyVx, const uint8_t* low) {
+    memset(s, 0, sizeof(*s));
+    for (int i = 0; i < 16; i++) {
+        s->V[i]    = nextRandom(rng);
+        s->keys[i] = nextRandom(rng) % 4 == 0;
+    }
+    if (keyVx) s->V[(opcode >> 8) & 0xF] &= 0xF;
+
+    // Away from the ends of memory, so nothing wraps
+    s->I  = ROM_OFFSET + nextRandom(rng) % 0xC00;
+    s->pc = ROM_OFFSET + 2 * (nextRandom(rng) % 0x600);
+    s->sp = 1 + nextRandom(rng) % (STACK_SIZE - 2);
+    for (int i = 1; i < STACK_SIZE; i++) {
+        s->stack[i] = ROM_OFFSET + 2 * (nextRandom(rng) % 0x600);
+    }
+    s->dt = nextRandom(rng);
+    s->st = nextRandom(rng);
+
+    memcpy(s->memory, low, ROM_OFFSET);
+    for (int addr = ROM_OFFSET; addr < MEMORY_SIZE; addr++) {
+        s->memory[addr] = nextRandom(rng);
+    }
+    s->memory[s->pc]     = opcode >> 8;
+    s->memory[s->pc + 1] = opcode & 0xFF;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            s->screen[y][x] = nextRandom(rng) % 3 == 0;
+        }
+    }
+}
+
+static int checkTable(uint32_t seed) {
+    static Emulator emu;
+    static RefState want, got;
+    if (!Emulator_init(&emu, PLATFORM_CHIP8)) {
+        printf("Out of memory\n");
+        return 2;
+    }
+
+    uint8_t low[ROM_OFFSET]; // the fonts
+    memcpy(low, emu.memory, ROM_OFFSET);
+
+    uint32_t rng = seed * 2654435761u | 1;
+    int      failedRows = 0;
+    int      rows = (int)(sizeof(TABLE) / sizeof(TABLE[0]));
+    printf("Opcode  Trials  Mismatches  Instruction, first mismatch\n");
+    for (int r = 0; r < rows; r++) {
+        const TableRow* row = &TABLE[r];
+        int  mismatches = 0;
+        char example[256] = "";
+
+        for (int t = 0; t < TABLE_TRIALS; t++) {
+            uint16_t opcode = row->base | (nextRandom(&rng) & ~row->fixed);
+            randomState(&rng, &want, opcode, row->keyVx, low);
+            toEmulator(&want, &emu);
+            uint16_t pc = want.pc;
+
+            bool      defined = refExecute(&want, opcode);
+            EmuStatus status  = Emulator_step(&emu);
+            // LD Vx, K only starts waiting on its first step
+            if ((opcode & 0xF0FF) == 0xF00A && status == EMU_OK && emu.waitingForInput) status = Emulator_step(&emu);
+            fromEmulator(&emu, &got);
+
+            if ((opcode & 0xF000) == 0xC000) { // any value within the mask will do
+                uint8_t x = (opcode >> 8) & 0xF;
+                want.V[x] = got.V[x] & opcode;
+                if (got.V[x] & ~opcode & 0xFF) want.V[x] = ~got.V[x];
+            }
+
+            bool ran = status == EMU_OK || status == EMU_HALTED;
+            bool same = memcmp(&want, &got, sizeof(want)) == 0;
+            if (ran == defined && (!ran || same)) continue;
+
+            if (mismatches++ == 0) {
+                int length = snprintf(example, sizeof(example), "%04X at %03X:", opcode, pc);
+                if (ran != defined) {
+                    snprintf(example + length, sizeof(example) - length, " status %s, want %s",
+                             Emulator_statusName(status), defined ? "ok" : "an error");
+                } else {
+                    describeDifference(&want, &got, example + length, sizeof(example) - length);
+                }
+            }
+        }
+
+        printf("%-6s  %6d  %10d  %-4s%s%s\n", row->pattern, TABLE_TRIALS, mismatches,
+               Opcode_name(Opcode_kind(row->base)), mismatches ? "  e.g. " : "", example);
+        if (mismatches) failedRows++;
+    }
+
+    // Cxkk again, for whether every value can come up
+    bool seen[256] = { false };
+    toEmulator(&want, &emu);
+    for (int i = 0; i < RANDOM_DRAWS; i++) {
+        emu.memory[emu.pc] = 0xC0;
+        emu.memory[emu.pc + 1] = 0xFF;
+        uint16_t pc = emu.pc;
+        Emulator_step(&emu);
+        seen[emu.registers[0]] = true;
+        emu.pc = pc;
+    }
+    int missing = 0, example = -1;
+    for (int v = 0; v < 256; v++) {
+        if (!seen[v]) {
+            missing++;
+            if (example < 0) example = v;
+        }
+    }
+    if (missing > 0) {
+        printf("Cxkk: %d of 256 values never drawn in %d tries, e.g. %02X\n", missing, RANDOM_DRAWS, example);
+        failedRows++;
+    }
+
+    printf("%d of %d checks mismatch the reference\n", failedRows, rows + 1);
+    Emulator_free(&emu);
+    return failedRows > 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* filename  = NULL;
+    const char* inputName = NULL;
+    EmuPlatform platform;
+    bool        platformSet    = false;
+    int         cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    int         frames         = -1;
+    int         every          = -1;
+    int         tier           = EMU_DEFAULT_TIER_THRESHOLD;
+    uint32_t    seed           = EMU_DEFAULT_SEED;
+    int         fuzzCases      = 0;
+    bool        table          = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            platformSet = Emulator_parsePlatform(argv[++i], &platform);
+            if (!platformSet) printf("Unknown platform %s; expected chip8, schip or xochip\n", argv[i]);
+        } else if (strcmp(argv[i], "-cpf") == 0 && i + 1 < argc) {
+            cyclesPerFrame = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-every") == 0 && i + 1 < argc) {
+            every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-tier") == 0 && i + 1 < argc) {
+            tier = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-input") == 0 && i + 1 < argc) {
+            inputName = argv[++i];
+        } else if (strcmp(argv[i], "-fuzz") == 0 && i + 1 < argc) {
+            fuzzCases = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-table") == 0) {
+            table = true;
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (cyclesPerFrame < 1) cyclesPerFrame = 1;
+    if (every < 1) every = cyclesPerFrame;
+    if (tier < 0)   tier = 0;
+    if (tier > 255) tier = 255;
+
+    if (table) return checkTable(seed);
+    if (fuzzCases > 0) {
+        return fuzz(platformSet ? platform : PLATFORM_CHIP8, fuzzCases, seed, cyclesPerFrame,
+                    frames > 0 ? frames : DEFAULT_FUZZ_FRAMES);
+    }
+
+    if (filename == NULL) {
+        printf("Missing argument: filename.\nUsage: difftest [-p platform] [-cpf N] [-frames N] [-every N] [-tier N]\n"
+               "                [-seed N] [-input script] <rom>\n"
+               "       difftest -fuzz N [-p platform] [-cpf N] [-frames N] [-seed N]\n"
+               "       difftest -table [-seed N]\n");
+        return 2;
+    }
+    if (!platformSet) platform = Emulator_guessPlatform(filename);
+
+    static InputEvent events[MAX_INPUT_EVENTS];
+    int eventCount = 0;
+    if (inputName != NULL) {
+        eventCount = readInputScript(inputName, events, MAX_INPUT_EVENTS);
+        if (eventCount < 0) return 2;
+    }
+
+    static Lockstep ls;
+    if (!Lockstep_init(&ls, platform)) {
+        printf("Out of memory\n");
+        return 2;
+    }
+
+    FILE* rom = fopen(filename, "rb");
+    if (rom == NULL) {
+        printf("Couldn't open file\n");
+        return 2;
+    }
+    static uint8_t data[XO_MAX_ROM_SIZE + 1];
+    size_t size = fread(data, 1, sizeof(data), rom);
+    fclose(rom);
+    if (!Emulator_loadRom(&ls.ref, data, size)) {
+        printf("ROM too big!\n");
+        return 2;
+    }
+    Emulator_seed(&ls.ref, seed);
+    Emulator_copy(&ls.fast, &ls.ref);
+    ls.fast.tierThreshold = tier;
+
+    ls.name = filename;
+    bool same = runLockstep(&ls, frames > 0 ? frames : DEFAULT_FRAMES, cyclesPerFrame, every, events, eventCount);
+    if (same) {
+        printf("%s: backends agree over %llu instructions", filename, (unsigned long long)ls.cycle);
+        if (ls.stopped != EMU_OK) printf(", where both stopped: %s", Emulator_statusName(ls.stopped));
+        printf("\n");
+    }
+    Lockstep_free(&ls);
+    return same ? 0 : 1;
+}
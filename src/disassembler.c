@@ -2,11 +2,23 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <SDL2/sdl.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-const int MEMORY_SIZE  = 4096;
-const int ROM_OFFSET   = 0x200; // 512
-const int MAX_ROM_SIZE = MEMORY_SIZE - ROM_OFFSET;
+#include "cfg.h"
+#include "opcodes.h"
+
+#define MEMORY_SIZE  4096
+#define ROM_OFFSET   0x200 // 512
+#define MAX_ROM_SIZE (MEMORY_SIZE - ROM_OFFSET)
 
 typedef struct {
     uint8_t  memory[MEMORY_SIZE];
@@ -17,119 +29,423 @@ void preamble(uint16_t pc, uint16_t opcode) {
     printf("%04X: (%04X) ", pc, opcode);
 }
 
-int main(int argc, const char* argv[]) {
-    Emulator emu;
+/**
+ * Writes the label for addr into buf if the control flow graph marks it as a
+ * jump, call or sprite target. Returns false if addr has no label.
+ */
+bool labelName(char* buf, size_t size, uint16_t addr, const Cfg* cfg) {
+    if (cfg == NULL || addr >= CFG_MEM_SZ) return false;
 
-    const char* filename = "roms/Maze.ch8";
-    if (argc == 2) {
-        filename = argv[1];
+    uint8_t f = cfg->flags[addr];
+    if (f & CFG_CALL_TGT) {
+        snprintf(buf, size, "SUB%04X", addr);
+    } else if (f & CFG_JUMP_TGT) {
+        snprintf(buf, size, "L%04X", addr);
+    } else if (f & CFG_DATA_REF) {
+        snprintf(buf, size, "D%04X", addr);
+    } else {
+        return false;
     }
+    return true;
+}
 
-    int64_t size;
-    { // Load ROM
-        SDL_RWops* rom = SDL_RWFromFile(filename, "rb");
-        if (rom != NULL) {
-            size = SDL_RWsize(rom);
-
-            if (size > MAX_ROM_SIZE) {
-                printf("ROM too big!\n");
-                SDL_RWclose(rom);
-                return 1;
-            }
+void printLabel(uint16_t addr, const Cfg* cfg) {
+    char label[16];
+    if (labelName(label, sizeof(label), addr, cfg)) {
+        printf("%s:\n", label);
+    }
+}
 
-            uint8_t* data = emu.memory + ROM_OFFSET;
+void printInstruction(uint16_t opcode, const Cfg* cfg) {
+    char label[16];
+    char line[64];
+    bool hasLabel = labelName(label, sizeof(label), opcode & 0x0FFF, cfg);
 
-            if (SDL_RWread(rom, data, size, 1) > 0) {
-                SDL_RWclose(rom);
-            } else {
-                printf("Couldn't read file\n");
-                SDL_RWclose(rom);
-                return 1;
-            }
-        } else {
-            printf("Couldn't open file\n");
-            return 1;
-        }
-    }
+    Opcode_format(line, sizeof(line), opcode, hasLabel ? label : NULL);
+    puts(line);
+}
 
+/**
+ * Linear sweep: decodes every two bytes from the start of the ROM,
+ * whether they are code or not.
+ */
+void disassembleLinear(Emulator* emu, int64_t size) {
     uint16_t opcode;
-    uint16_t addr;
-    uint8_t  x;
-    uint8_t  y;
-    uint8_t  z;
-    uint8_t  yz;
-    for (emu.pc = 0x200; emu.pc < ROM_OFFSET + size; emu.pc += 2) {
-        opcode = emu.memory[emu.pc] << 8 | emu.memory[emu.pc + 1];
-
-        preamble(emu.pc, opcode);
-
-        addr = (opcode & 0x0FFF);
-        x    = (opcode & 0x0F00) >> 8;
-        y    = (opcode & 0x00F0) >> 4;
-        z    = (opcode & 0x000F);
-        yz   = (opcode & 0x00FF);
-
-        switch (opcode & 0xF000) {
-            case 0x0000: {
-                switch (opcode) {
-                    case 0x00E0: printf("CLS\n"); break;
-                    case 0x00EE: printf("RET\n"); break;
-                    default:     printf("Unknown opcode\n");
-                }
-            }
-            break;
-            case 0x1000: printf("JP   0x%04X\n", addr); break;
-            case 0x2000: printf("CALL 0x%04X\n", addr); break;
-            case 0x3000: printf("SE   V%d,\t%d\n", x, yz); break;
-            case 0x4000: printf("SNE  V%d,\t%d\n", x, yz); break;
-            case 0x5000: printf("SE   V%d,\tV%d\n", x, y); break;
-            case 0x6000: printf("LD   V%d,\t%d\n", x, yz); break;
-            case 0x7000: printf("ADD  V%d,\t%d\n", x, yz); break;
-            case 0x8000: {
-                switch (z) {
-                    case 0x0: printf("LD   V%d,\tV%d\n", x, y); break;
-                    case 0x1: printf("OR   V%d,\tV%d\n", x, y); break;
-                    case 0x2: printf("AND  V%d,\tV%d\n", x, y); break;
-                    case 0x3: printf("XOR  V%d,\tV%d\n", x, y); break;
-                    case 0x4: printf("ADD  V%d,\tV%d\n", x, y); break;
-                    case 0x5: printf("SUB  V%d,\tV%d\n", x, y); break;
-                    case 0x6: printf("SHR  V%d,\t{V%d}\n", x, y); break;
-                    case 0x7: printf("SUBN V%d,\tV%d\n", x, y); break;
-                    case 0xE: printf("SHL  V%d,\t{V%d}\n", x, y); break;
-                    default:     printf("Unknown opcode\n");
+    for (emu->pc = ROM_OFFSET; emu->pc < ROM_OFFSET + size; emu->pc += 2) {
+        opcode = emu->memory[emu->pc] << 8 | emu->memory[emu->pc + 1];
+        preamble(emu->pc, opcode);
+        printInstruction(opcode, NULL);
+    }
+}
+
+/**
+ * Recursive traversal: only decodes what is reachable from the entry point
+ * and prints everything else as data, with labels on every branch, call and
+ * sprite target.
+ */
+void disassembleRecursive(Emulator* emu, const Cfg* cfg, int64_t size) {
+    size_t codeBytes = 0;
+    for (int i = ROM_OFFSET; i < ROM_OFFSET + size; i++) {
+        if (Cfg_isCode(cfg, i)) codeBytes++;
+    }
+    printf("; %zu blocks, %zu code bytes, %zu data bytes\n",
+           cfg->blockCount, codeBytes, (size_t)size - codeBytes);
+
+    emu->pc = ROM_OFFSET;
+    while (emu->pc < ROM_OFFSET + size) {
+        printLabel(emu->pc, cfg);
+
+        if (cfg->flags[emu->pc] & CFG_INSTR) {
+            uint16_t opcode = emu->memory[emu->pc] << 8 | emu->memory[emu->pc + 1];
+            preamble(emu->pc, opcode);
+            if (opcode == 0xF000 && Cfg_isCode(cfg, emu->pc + 2)) { // XO-CHIP LD I, long nnnn
+                uint16_t operand = emu->memory[emu->pc + 2] << 8 | emu->memory[emu->pc + 3];
+                char     label[16];
+                if (labelName(label, sizeof(label), operand, cfg)) {
+                    printf("LD   I,\tLONG %s\n", label);
+                } else {
+                    printf("LD   I,\tLONG 0x%04X\n", operand);
                 }
+                emu->pc += 4;
+                continue;
             }
-            break;
-            case 0x9000: printf("SNE  V%d, V%d\n", x, y);
-            case 0xA000: printf("LD   I,\t%d\n", addr); break;
-            case 0xB000: printf("JP   V0\t%d\n", addr); break;
-            case 0xC000: printf("RND  V%d,\t%d\n", x, yz); break;
-            case 0xD000: printf("DRW  V%d,\tV%d,\t%d\n", x, y, z); break;
-            case 0xE000: {
-                switch (yz) {
-                    case 0x9E: printf("SKP  V%d\n", x); break;
-                    case 0xA1: printf("SKNP V%d\n", x); break;
-                }
+            printInstruction(opcode, cfg);
+            emu->pc += 2;
+        } else {
+            uint8_t byte = emu->memory[emu->pc];
+            printf("%04X: (  %02X) BYTE 0b", emu->pc, byte);
+            for (int bit = 7; bit >= 0; bit--) {
+                printf("%c", (byte >> bit) & 1 ? '1' : '0');
             }
-            break;
-            case 0xF000: {
-                switch (yz) {
-                    case 0x07: printf("LD   V%d,\tDT\n", x); break;
-                    case 0x0A: printf("LD   V%d\tK\n", x); break;
-                    case 0x15: printf("LD   DT,\tV%d\n", x); break;
-                    case 0x18: printf("LD   ST,\tV%d\n", x); break;
-                    case 0x1E: printf("ADD  I,\tV%d\n", x); break;
-                    case 0x29: printf("LD   F,\tV%d\n", x); break;
-                    case 0x33: printf("LD   B,\tV%d\n", x); break;
-                    case 0x55: printf("LD   [I]\tV%d\n", x); break;
-                    case 0x65: printf("LD   V%d\t[I]\n", x); break;
-                    default:     printf("Unknown opcode\n");
-                }
+            printf("\n");
+            emu->pc += 1;
+        }
+    }
+}
+
+#define BATCH_BUFFER_SZ (256 * 1024)
+#define BATCH_LINE_SZ   32
+#define INDEX_VERSION   2 // 2: SUPER-CHIP / XO-CHIP kinds in the histogram
+
+// Every possible listing line body, so batch mode never formats at runtime
+char    lineText[0x10000][BATCH_LINE_SZ];
+uint8_t lineLength[0x10000];
+
+void buildLineTable() {
+    for (uint32_t op = 0; op < 0x10000; op++) {
+        int len = Opcode_format(lineText[op], BATCH_LINE_SZ - 1, op, NULL);
+        lineText[op][len] = '\n';
+        lineLength[op] = len + 1;
+    }
+}
+
+typedef struct {
+    int    fd;
+    size_t used;
+    bool   failed;
+    char   data[BATCH_BUFFER_SZ];
+} OutBuffer;
+
+bool OutBuffer_open(OutBuffer* out, const char* path) {
+    out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    out->used = 0;
+    out->failed = (out->fd < 0);
+    return !out->failed;
+}
+
+void OutBuffer_flush(OutBuffer* out) {
+    size_t done = 0;
+    while (done < out->used && !out->failed) {
+        ssize_t n = write(out->fd, out->data + done, out->used - done);
+        if (n <= 0) {
+            out->failed = true;
+        } else {
+            done += n;
+        }
+    }
+    out->used = 0;
+}
+
+void OutBuffer_write(OutBuffer* out, const void* data, size_t len) {
+    if (out->used + len > BATCH_BUFFER_SZ) OutBuffer_flush(out);
+    memcpy(out->data + out->used, data, len);
+    out->used += len;
+}
+
+void OutBuffer_writeU16(OutBuffer* out, uint16_t v) {
+    uint8_t b[2] = { v & 0xFF, v >> 8 };
+    OutBuffer_write(out, b, 2);
+}
+
+void OutBuffer_writeU32(OutBuffer* out, uint32_t v) {
+    uint8_t b[4] = { v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >> 24 };
+    OutBuffer_write(out, b, 4);
+}
+
+bool OutBuffer_close(OutBuffer* out) {
+    OutBuffer_flush(out);
+    if (close(out->fd) != 0) out->failed = true;
+    return !out->failed;
+}
+
+void writeHex4(char* dst, uint16_t v) {
+    static const char HEX[] = "0123456789ABCDEF";
+    dst[0] = HEX[(v >> 12) & 0xF];
+    dst[1] = HEX[(v >> 8) & 0xF];
+    dst[2] = HEX[(v >> 4) & 0xF];
+    dst[3] = HEX[v & 0xF];
+}
+
+typedef struct {
+    const char*   inDir;
+    const char*   outDir;
+    char**        names;
+    size_t        count;
+    atomic_size_t next;
+    atomic_size_t failures;
+    atomic_size_t bytes;
+} BatchJob;
+
+/**
+ * Maps the ROM in path read-only and sets *size. Prints why and returns
+ * NULL if it can't be opened, is empty or doesn't fit in memory.
+ */
+const uint8_t* mapRom(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: couldn't open file\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > MAX_ROM_SIZE) {
+        fprintf(stderr, "%s: empty or too big\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    const uint8_t* rom = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rom == MAP_FAILED) {
+        fprintf(stderr, "%s: couldn't map file\n", path);
+        return NULL;
+    }
+    return rom;
+}
+
+/**
+ * Disassembles one ROM into <name>.txt, a linear listing in the same format
+ * as the default mode, and <name>.c8i, a compact opcode index:
+ *
+ *   "C8IX", u16 version, u16 ROM size, u32 word count,
+ *   u32 histogram[OP_KIND_COUNT], u8 kind[word count]
+ *
+ * All integers are little endian. Returns false on any I/O error.
+ */
+bool disassembleBatchFile(BatchJob* job, const char* name, OutBuffer* out) {
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%s", job->inDir, name);
+    size_t         size;
+    const uint8_t* rom = mapRom(path, &size);
+    if (rom == NULL) return false;
+
+    size_t   wordCount = (size + 1) / 2;
+    uint8_t  kinds[MAX_ROM_SIZE / 2 + 1];
+    uint32_t histogram[OP_KIND_COUNT];
+    memset(histogram, 0, sizeof(histogram));
+
+    bool ok = true;
+
+    { // Text listing
+        snprintf(path, sizeof(path), "%s/%s.txt", job->outDir, name);
+        ok = OutBuffer_open(out, path);
+
+        char prefix[14] = "0000: (0000) ";
+        for (size_t i = 0; i < wordCount && ok; i++) {
+            size_t   offset = i * 2;
+            uint16_t opcode = rom[offset] << 8;
+            if (offset + 1 < size) opcode |= rom[offset + 1];
+
+            kinds[i] = Opcode_kind(opcode);
+            histogram[kinds[i]]++;
+
+            writeHex4(prefix, ROM_OFFSET + offset);
+            writeHex4(prefix + 7, opcode);
+            OutBuffer_write(out, prefix, 13);
+            OutBuffer_write(out, lineText[opcode], lineLength[opcode]);
+        }
+        ok = OutBuffer_close(out) && ok;
+    }
+
+    if (ok) { // Opcode index
+        snprintf(path, sizeof(path), "%s/%s.c8i", job->outDir, name);
+        ok = OutBuffer_open(out, path);
+
+        OutBuffer_write(out, "C8IX", 4);
+        OutBuffer_writeU16(out, INDEX_VERSION);
+        OutBuffer_writeU16(out, size);
+        OutBuffer_writeU32(out, wordCount);
+        for (int k = 0; k < OP_KIND_COUNT; k++) {
+            OutBuffer_writeU32(out, histogram[k]);
+        }
+        OutBuffer_write(out, kinds, wordCount);
+        ok = OutBuffer_close(out) && ok;
+    }
+
+    if (!ok) fprintf(stderr, "%s: couldn't write output\n", name);
+
+    munmap((void*)rom, size);
+    atomic_fetch_add(&job->bytes, size);
+    return ok;
+}
+
+void* batchWorker(void* arg) {
+    BatchJob*  job = arg;
+    OutBuffer* out = malloc(sizeof(OutBuffer));
+
+    for (;;) {
+        size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->count) break;
+        if (!disassembleBatchFile(job, job->names[i], out)) {
+            atomic_fetch_add(&job->failures, 1);
+        }
+    }
+
+    free(out);
+    return NULL;
+}
+
+int compareNames(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * Disassembles every .ch8 file in inDir into outDir using threadCount
+ * worker threads.
+ */
+int disassembleBatch(const char* inDir, const char* outDir, int threadCount) {
+    BatchJob job;
+    memset(&job, 0, sizeof(BatchJob));
+    job.inDir  = inDir;
+    job.outDir = outDir;
+
+    { // Collect ROMs
+        DIR* dir = opendir(inDir);
+        if (dir == NULL) {
+            printf("Couldn't open directory %s\n", inDir);
+            return 1;
+        }
+
+        size_t capacity = 0;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            size_t len = strlen(entry->d_name);
+            if (len < 4 || strcasecmp(entry->d_name + len - 4, ".ch8") != 0) continue;
+
+            if (job.count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                job.names = realloc(job.names, capacity * sizeof(char*));
             }
-            break;
-            default: printf("Unknown opcode\n");
+            job.names[job.count++] = strdup(entry->d_name);
+        }
+        closedir(dir);
+
+        qsort(job.names, job.count, sizeof(char*), compareNames);
+    }
+
+    mkdir(outDir, 0755);
+    buildLineTable();
+    Opcode_kind(0); // build the decode table before the workers share it
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (threadCount < 1) threadCount = 1;
+    pthread_t* threads = malloc(threadCount * sizeof(pthread_t));
+    for (int i = 0; i < threadCount; i++) {
+        pthread_create(&threads[i], NULL, batchWorker, &job);
+    }
+    for (int i = 0; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    printf("Disassembled %zu ROMs (%zu bytes) in %.2f ms on %d threads, %zu failed\n",
+           job.count, (size_t)job.bytes, ms, threadCount, (size_t)job.failures);
+
+    for (size_t i = 0; i < job.count; i++) {
+        free(job.names[i]);
+    }
+    free(job.names);
+
+    return job.failures > 0 ? 1 : 0;
+}
+
+int main(int argc, const char* argv[]) {
+    Emulator emu;
+    memset(&emu, 0, sizeof(emu));
+
+    if (argc > 1 && strcmp(argv[1], "-batch") == 0) {
+        int threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+        int i = 2;
+        if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+            threadCount = atoi(argv[i + 1]);
+            i += 2;
         }
+        if (argc - i != 2) {
+            printf("Usage: disassembler -batch [-j threads] <romdir> <outdir>\n");
+            return 1;
+        }
+        return disassembleBatch(argv[i], argv[i + 1], threadCount);
     }
 
+    const char* filename = "roms/Maze.ch8";
+    bool recursive = false;
+    bool dot = false;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc - 1; i++) {
+            if (strcmp(argv[i], "-r") == 0) recursive = true;
+            if (strcmp(argv[i], "-g") == 0) dot = true;
+        }
+
+        filename = argv[argc-1];
+    }
+
+    int64_t size;
+    { // Load ROM
+        size_t         romSize;
+        const uint8_t* rom = mapRom(filename, &romSize);
+        if (rom == NULL) return 1;
+
+        memcpy(emu.memory + ROM_OFFSET, rom, romSize);
+        munmap((void*)rom, romSize);
+        size = romSize;
+    }
+
+    if (!recursive && !dot) {
+        disassembleLinear(&emu, size);
+        return 0;
+    }
+
+    Cfg cfg;
+    Cfg_init(&cfg);
+    if (!Cfg_build(&cfg, emu.memory, ROM_OFFSET, ROM_OFFSET + size)) {
+        printf("Couldn't build control flow graph\n");
+        return 1;
+    }
+
+    if (dot) {
+        Cfg_printDot(&cfg, stdout);
+    } else {
+        disassembleRecursive(&emu, &cfg, size);
+    }
+
+    Cfg_free(&cfg);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,532 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emulator.h"
+#include "font.h"
+
+#ifndef CHIP8_DEBUG
+#define CHIP8_DEBUG 0
+#endif
+
+#define debug_print(...) \
+    do { if (CHIP8_DEBUG > 0) fprintf(stdout, __VA_ARGS__); } while (0)
+
+static const uint8_t keyValues[16] =
+   {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+static void preamble(Emulator* emu) {
+    debug_print("%04X: (%04X) ", emu->pc, emu->opcode);
+}
+
+static void clearDisplay(Emulator* emu) {
+    for (int p = 0; p < SCREEN_PLANES; p++) {
+        if (emu->planes & (1 << p)) {
+            memset(emu->display.rows[p], 0, sizeof(emu->display.rows[p]));
+        }
+    }
+}
+
+/*
+ * Tiers. Emulator_run starts all code in the plain interpreter (tier 0),
+ * counting how often each address runs in emu->hotness. When an address
+ * reaches emu->tierThreshold, the block from there on is promoted to tier
+ * 1: each address is predecoded and, if a common sequence starts there,
+ * emu->fusion records it so the whole sequence then runs in one dispatch.
+ * Short runs never pay for predecoding; hot loops reach it within a few
+ * frames.
+ *
+ * The entry belongs to the start address only, so a jump into the middle
+ * of a sequence finds that address's own entry and runs from there as
+ * usual. None of the fused sequences write memory themselves; the
+ * instructions that do (Fx33, Fx55, 5xy2) demote any code that overlaps
+ * what they wrote, and ROM loads reset every tier.
+ */
+enum {
+    FUSE_UNKNOWN,   // tier 0, not predecoded; zero, so clearing the table demotes everything
+    FUSE_NONE,      // tier 1, nothing to fuse
+    FUSE_LD_I_DRW,  // Annn, Dxyn
+    FUSE_WAIT_DT,   // Fx07, 3x00, 1nnn: spin until the delay timer runs out
+    FUSE_LD_LD,     // 6xkk, 6ykk
+    FUSE_ADD_I_LD   // Fx1E, Fy65
+};
+
+#define FUSE_MAX_BYTES 6 // the longest sequence is three instructions
+
+// The interpreter instances, generated from interp.inc further down
+static EmuStatus stepChip8(Emulator* emu);
+static EmuStatus stepSchip(Emulator* emu);
+static EmuStatus stepXochip(Emulator* emu);
+static EmuStatus runChip8(Emulator* emu, int cycles, int* executed);
+static EmuStatus runSchip(Emulator* emu, int cycles, int* executed);
+static EmuStatus runXochip(Emulator* emu, int cycles, int* executed);
+
+static EmuStatus (* const STEP_FUNCTIONS[])(Emulator*) = {
+    [PLATFORM_CHIP8]  = stepChip8,
+    [PLATFORM_SCHIP]  = stepSchip,
+    [PLATFORM_XOCHIP] = stepXochip,
+};
+
+static EmuStatus (* const RUN_FUNCTIONS[])(Emulator*, int, int*) = {
+    [PLATFORM_CHIP8]  = runChip8,
+    [PLATFORM_SCHIP]  = runSchip,
+    [PLATFORM_XOCHIP] = runXochip,
+};
+
+bool Emulator_init(Emulator* emu, EmuPlatform platform) {
+    // The interpreters mask every guest address to the platform's memory
+    // size, and the whole 64K is always there, so nothing reaches past it
+    uint8_t* memory = calloc(1, XO_MEMORY_SIZE);
+    if (memory == NULL) return false;
+
+    Emulator_initWithMemory(emu, platform, memory);
+    emu->ownsMemory = true;
+    return true;
+}
+
+void Emulator_initWithMemory(Emulator* emu, EmuPlatform platform, uint8_t* memory) {
+    emu->memory     = memory;
+    emu->ownsMemory = false;
+    emu->heatmap    = NULL;
+    Emulator_reset(emu, platform);
+}
+
+void Emulator_free(Emulator* emu) {
+    if (emu->ownsMemory) free(emu->memory);
+    emu->memory = NULL;
+}
+
+void Emulator_copy(Emulator* dst, const Emulator* src) {
+    uint8_t*    memory     = dst->memory;
+    bool        ownsMemory = dst->ownsMemory;
+    EmuHeatmap* heatmap    = dst->heatmap;
+    memcpy(memory, src->memory, XO_MEMORY_SIZE);
+    *dst = *src;
+    dst->memory     = memory;
+    dst->ownsMemory = ownsMemory;
+    dst->heatmap    = heatmap;
+}
+
+void Emulator_reset(Emulator* emu, EmuPlatform platform) {
+    emu->platform   = platform;
+    emu->step       = STEP_FUNCTIONS[platform];
+    emu->run        = RUN_FUNCTIONS[platform];
+    emu->memoryMask = platform == PLATFORM_XOCHIP ? XO_MEMORY_SIZE - 1 : MEMORY_SIZE - 1;
+
+    emu->pc     = ROM_OFFSET; // Program counter starts at 0x200
+    emu->opcode = 0;     // Reset current opcode
+    emu->I      = 0;     // Reset index register
+    emu->sp     = 0;     // Reset stack pointer
+
+    memset(&emu->display, 0, sizeof(emu->display));
+    emu->planes = 1;
+    for (int i = 0; i < 16; i++) {
+        emu->stack[i] = 0;
+    }
+    for (int i = 0; i < 16; i++) {
+        emu->registers[i] = 0;
+    }
+    for (int i = 0; i < 16; i++) {
+        emu->key[i] = 0;
+    }
+    memset(emu->memory, 0, XO_MEMORY_SIZE);
+    memset(emu->fusion, FUSE_UNKNOWN, sizeof(emu->fusion));
+    memset(emu->hotness, 0, sizeof(emu->hotness));
+    for (size_t i = 0; i < CHIP8_FONT_SIZE; i++) {
+        emu->memory[i] = CHIP8_FONT[i];
+    }
+    for (size_t i = 0; i < CHIP8_BIG_FONT_SIZE; i++) {
+        emu->memory[BIG_FONT_OFFSET + i] = CHIP8_BIG_FONT[i];
+    }
+
+    emu->delay_timer = 0;
+    emu->sound_timer = 0;
+
+    emu->waitingForInput = false;
+    emu->drawFlag = false;
+
+    memset(emu->flags, 0, sizeof(emu->flags));
+    memset(emu->audioPattern, 0, sizeof(emu->audioPattern));
+    emu->pitch = 64; // 4000 Hz, the XO-CHIP default
+    Emulator_seed(emu, EMU_DEFAULT_SEED);
+
+    emu->tierThreshold = EMU_DEFAULT_TIER_THRESHOLD;
+    emu->promotions    = 0;
+    emu->demotions     = 0;
+
+    emu->profiling = false;
+    emu->drawNs    = 0;
+}
+
+void Emulator_seed(Emulator* emu, uint32_t seed) {
+    emu->rng = seed ^ 0x9E3779B9;
+    if (emu->rng == 0) emu->rng = 1; // xorshift never leaves zero
+}
+
+bool Emulator_parsePlatform(const char* name, EmuPlatform* platform) {
+    if (strcmp(name, "chip8") == 0)  { *platform = PLATFORM_CHIP8;  return true; }
+    if (strcmp(name, "schip") == 0)  { *platform = PLATFORM_SCHIP;  return true; }
+    if (strcmp(name, "xochip") == 0) { *platform = PLATFORM_XOCHIP; return true; }
+    return false;
+}
+
+const char* Emulator_platformName(EmuPlatform platform) {
+    switch (platform) {
+        case PLATFORM_CHIP8:  return "chip8";
+        case PLATFORM_SCHIP:  return "schip";
+        case PLATFORM_XOCHIP: return "xochip";
+    }
+    return "?";
+}
+
+EmuPlatform Emulator_guessPlatform(const char* filename) {
+    size_t len = strlen(filename);
+    if (len > 4 && strcmp(filename + len - 4, ".sc8") == 0) return PLATFORM_SCHIP;
+    if (len > 4 && strcmp(filename + len - 4, ".xo8") == 0) return PLATFORM_XOCHIP;
+    return PLATFORM_CHIP8;
+}
+
+size_t Emulator_maxRomSize(const Emulator* emu) {
+    return emu->memoryMask + 1 - ROM_OFFSET;
+}
+
+bool Emulator_loadRom(Emulator* emu, const uint8_t* data, size_t size) {
+    if (size > Emulator_maxRomSize(emu)) return false;
+    memcpy(emu->memory + ROM_OFFSET, data, size);
+    memset(emu->fusion, FUSE_UNKNOWN, sizeof(emu->fusion));
+    memset(emu->hotness, 0, sizeof(emu->hotness));
+    return true;
+}
+
+bool Emulator_patchRom(Emulator* emu, const uint8_t* data, size_t size, size_t oldSize) {
+    size_t maxSize = Emulator_maxRomSize(emu);
+    if (size > maxSize) return false;
+    memcpy(emu->memory + ROM_OFFSET, data, size);
+    if (oldSize > maxSize) oldSize = maxSize;
+    if (oldSize > size) memset(emu->memory + ROM_OFFSET + size, 0, oldSize - size);
+    memset(emu->fusion, FUSE_UNKNOWN, sizeof(emu->fusion));
+    memset(emu->hotness, 0, sizeof(emu->hotness));
+    return true;
+}
+
+int EmuDisplay_width(const EmuDisplay* display) {
+    return display->hires ? HIRES_WIDTH : SCREEN_WIDTH;
+}
+
+int EmuDisplay_height(const EmuDisplay* display) {
+    return display->hires ? HIRES_HEIGHT : SCREEN_HEIGHT;
+}
+
+uint8_t EmuDisplay_pixel(const EmuDisplay* display, int x, int y) {
+    uint8_t color = 0;
+    for (int p = 0; p < SCREEN_PLANES; p++) {
+        color |= ((display->rows[p][y][x / 64] >> (63 - x % 64)) & 1) << p;
+    }
+    return color;
+}
+
+static uint16_t readOpcode(const Emulator* emu, uint16_t addr) {
+    return emu->memory[addr & emu->memoryMask] << 8 | emu->memory[(addr + 1) & emu->memoryMask];
+}
+
+/**
+ * The length of the instruction after the current one, for XO-CHIP skips:
+ * four bytes if it is F000 nnnn, two otherwise.
+ */
+static uint16_t nextLength(const Emulator* emu) {
+    return readOpcode(emu, emu->pc + 2) == 0xF000 ? 4 : 2;
+}
+
+// Scrolls move whole rows with memmove and shift pixels across the row's
+// words; n counts pixels of the current resolution.
+
+static void scrollDown(Emulator* emu, int n) {
+    int height = EmuDisplay_height(&emu->display);
+    if (n > height) n = height;
+    for (int p = 0; p < SCREEN_PLANES; p++) {
+        if (!(emu->planes & (1 << p))) continue;
+        uint64_t (*rows)[ROW_WORDS] = emu->display.rows[p];
+        memmove(rows[n], rows[0], (height - n) * sizeof(rows[0]));
+        memset(rows[0], 0, n * sizeof(rows[0]));
+    }
+}
+
+static void scrollUp(Emulator* emu, int n) {
+    int height = EmuDisplay_height(&emu->display);
+    if (n > height) n = height;
+    for (int p = 0; p < SCREEN_PLANES; p++) {
+        if (!(emu->planes & (1 << p))) continue;
+        uint64_t (*rows)[ROW_WORDS] = emu->display.rows[p];
+        memmove(rows[0], rows[n], (height - n) * sizeof(rows[0]));
+        memset(rows[height - n], 0, n * sizeof(rows[0]));
+    }
+}
+
+/**
+ * Shifts every row n (1-63) pixels sideways; pixels pushed past either
+ * edge are lost, and in low-res the second word stays clear.
+ */
+static void scrollSideways(Emulator* emu, int n, bool right) {
+    int height = EmuDisplay_height(&emu->display);
+    for (int p = 0; p < SCREEN_PLANES; p++) {
+        if (!(emu->planes & (1 << p))) continue;
+        for (int y = 0; y < height; y++) {
+            uint64_t* row = emu->display.rows[p][y];
+            if (right) {
+                row[1] = (row[1] >> n) | (row[0] << (64 - n));
+                row[0] >>= n;
+            } else {
+                row[0] = (row[0] << n) | (row[1] >> (64 - n));
+                row[1] <<= n;
+            }
+            if (!emu->display.hires) row[1] = 0;
+        }
+    }
+}
+
+// xorshift32
+static uint32_t nextRandom(Emulator* emu) {
+    uint32_t r = emu->rng;
+    r ^= r << 13;
+    r ^= r >> 17;
+    r ^= r << 5;
+    return emu->rng = r;
+}
+
+static uint64_t clockNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Heatmap counting; callers check emu->heatmap first
+
+static void recordExecute(Emulator* emu, uint16_t pc, int length) {
+    for (int i = 0; i < length; i++) {
+        emu->heatmap->executes[(pc + i) & emu->memoryMask]++;
+    }
+}
+
+static void recordRead(Emulator* emu, uint16_t addr, int length) {
+    for (int i = 0; i < length; i++) {
+        emu->heatmap->reads[(addr + i) & emu->memoryMask]++;
+    }
+}
+
+/**
+ * Lines up a sprite row, left-aligned in bits, with screen column x of a
+ * 128-pixel row. Returns whatever ran off the right edge, left-aligned, so
+ * the caller can wrap it around.
+ */
+static uint64_t placeSpriteRow(uint64_t bits, int x, uint64_t out[ROW_WORDS]) {
+    if (x < 64) {
+        out[0] = bits >> x;
+        out[1] = x > 0 ? bits << (64 - x) : 0;
+        return 0;
+    }
+    out[0] = 0;
+    out[1] = bits >> (x - 64);
+    return x > 64 ? bits << (128 - x) : 0;
+}
+
+/**
+ * Dxyn. Sprites are 8 pixels wide and n rows tall, or 16x16 for n = 0 with
+ * bigSprites, and XORed into every selected plane, each plane reading its
+ * own rows from memory after the previous one's. The start position wraps;
+ * pixels off the edge are clipped unless wrap is set. Returns true on a
+ * collision. The interpreter instances pass constants for the flags, so
+ * inlining drops the branches they don't take.
+ */
+static inline bool drawSprite(Emulator* emu, uint8_t xpos, uint8_t ypos, uint8_t n,
+                              bool bigSprites, bool wrap) {
+    int  width    = EmuDisplay_width(&emu->display);
+    int  height   = EmuDisplay_height(&emu->display);
+    bool big      = n == 0 && bigSprites;
+    int  lines    = big ? 16 : n;
+    int  x        = xpos % width;
+    int  y        = ypos % height;
+    bool collided = false;
+
+    uint64_t start = emu->profiling ? clockNs() : 0;
+    uint16_t addr  = emu->I;
+    for (int p = 0; p < SCREEN_PLANES; p++) {
+        if (!(emu->planes & (1 << p))) continue;
+
+        for (int line = 0; line < lines; line++) {
+            uint64_t bits;
+            if (big) {
+                bits = (uint64_t)(emu->memory[addr & emu->memoryMask] << 8 |
+                                  emu->memory[(addr + 1) & emu->memoryMask]) << 48;
+                addr += 2;
+            } else {
+                bits = (uint64_t)emu->memory[addr & emu->memoryMask] << 56;
+                addr += 1;
+            }
+
+            int row = y + line;
+            if (row >= height) {
+                if (!wrap) continue;
+                row -= height;
+            }
+
+            uint64_t sprite[ROW_WORDS];
+            uint64_t overflow = placeSpriteRow(bits, x, sprite);
+            if (!emu->display.hires) {
+                overflow  = sprite[1];
+                sprite[1] = 0;
+            }
+            if (wrap) sprite[0] |= overflow;
+
+            uint64_t* dest = emu->display.rows[p][row];
+            if ((dest[0] & sprite[0]) | (dest[1] & sprite[1])) collided = true;
+            dest[0] ^= sprite[0];
+            dest[1] ^= sprite[1];
+        }
+    }
+
+    if (emu->heatmap) recordRead(emu, emu->I, (uint16_t)(addr - emu->I));
+    if (emu->profiling) emu->drawNs += clockNs() - start;
+    return collided;
+}
+
+const char* Emulator_statusName(EmuStatus status) {
+    switch (status) {
+        case EMU_OK:             return "ok";
+        case EMU_HALTED:         return "halted";
+        case EMU_UNKNOWN_OPCODE: return "unknown opcode";
+        case EMU_BAD_KEY:        return "invalid key index";
+        case EMU_BAD_FONT:       return "invalid font character";
+    }
+    return "?";
+}
+
+static uint8_t predecode(const Emulator* emu, uint16_t pc) {
+    if (CHIP8_DEBUG > 0) return FUSE_NONE; // keep the trace one line per instruction
+
+    uint16_t a = readOpcode(emu, pc);
+    uint16_t b = readOpcode(emu, pc + 2);
+
+    if ((a & 0xF000) == 0xA000 && (b & 0xF000) == 0xD000) return FUSE_LD_I_DRW;
+    if ((a & 0xF000) == 0x6000 && (b & 0xF000) == 0x6000) return FUSE_LD_LD;
+    if ((a & 0xF0FF) == 0xF01E && (b & 0xF0FF) == 0xF065) return FUSE_ADD_I_LD;
+
+    if ((a & 0xF0FF) == 0xF007 && b == (0x3000 | (a & 0x0F00))) {
+        uint16_t c = readOpcode(emu, pc + 4);
+        // A jump to itself halts the machine, which only the single step reports
+        if ((c & 0xF000) == 0x1000 && (c & 0x0FFF) != ((pc + 4) & emu->memoryMask)) {
+            return FUSE_WAIT_DT;
+        }
+    }
+    return FUSE_NONE;
+}
+
+#define MAX_BLOCK_INSTRUCTIONS 64
+
+/**
+ * Tier 1: predecodes the straight-line run of code from start up to the
+ * next jump, call or return, or the next code that is already promoted.
+ */
+static void promoteBlock(Emulator* emu, uint16_t start) {
+    uint16_t addr = start & emu->memoryMask;
+    for (int i = 0; i < MAX_BLOCK_INSTRUCTIONS; i++) {
+        if (i > 0 && emu->fusion[addr] != FUSE_UNKNOWN) break;
+
+        uint16_t opcode = readOpcode(emu, addr);
+        emu->fusion[addr] = predecode(emu, addr);
+
+        uint16_t top = opcode & 0xF000;
+        if (top == 0x1000 || top == 0x2000 || top == 0xB000 || opcode == 0x00EE || opcode == 0x00FD) break;
+        addr = (addr + 2) & emu->memoryMask;
+    }
+    emu->promotions++;
+}
+
+/**
+ * Demotes whatever overlaps [addr, addr + length) back to the interpreter,
+ * to heat up again from zero.
+ */
+static void invalidateCode(Emulator* emu, uint16_t addr, int length) {
+    bool demoted = false;
+    for (int i = -(FUSE_MAX_BYTES - 1); i < length; i++) {
+        uint16_t at = (uint16_t)(addr + i) & emu->memoryMask;
+        demoted |= emu->fusion[at] != FUSE_UNKNOWN;
+        emu->fusion[at]  = FUSE_UNKNOWN;
+        emu->hotness[at] = 0;
+    }
+    if (demoted) emu->demotions++;
+}
+
+/**
+ * After an instruction stores to [addr, addr + length): demotes the code
+ * there and counts the writes, catching self-modifying code.
+ */
+static void wroteMemory(Emulator* emu, uint16_t addr, int length) {
+    invalidateCode(emu, addr, length);
+    if (!emu->heatmap) return;
+
+    EmuHeatmap* heatmap = emu->heatmap;
+    for (int i = 0; i < length; i++) {
+        uint16_t at = (addr + i) & emu->memoryMask;
+        heatmap->writes[at]++;
+        if (heatmap->executes[at] == 0) continue;
+
+        heatmap->smcWrites++;
+        if (!heatmap->smc[at]) {
+            heatmap->smc[at]       = true;
+            heatmap->smcWriter[at] = emu->pc;
+        }
+    }
+}
+
+// One interpreter per quirk profile; see interp.inc for what each quirk means
+
+#define INTERP_NAME    stepChip8 // COSMAC VIP
+#define INTERP_RUN     runChip8
+#define INTERP_SCHIP   0
+#define INTERP_XO      0
+#define QUIRK_SHIFT_VY 1
+#define QUIRK_INC_I    1
+#define QUIRK_VF_RESET 1
+#define QUIRK_WRAP     0
+#define QUIRK_JUMP_VX  0
+#include "interp.inc"
+
+#define INTERP_NAME    stepSchip // SUPER-CHIP 1.1 on the HP 48
+#define INTERP_RUN     runSchip
+#define INTERP_SCHIP   1
+#define INTERP_XO      0
+#define QUIRK_SHIFT_VY 0
+#define QUIRK_INC_I    0
+#define QUIRK_VF_RESET 0
+#define QUIRK_WRAP     0
+#define QUIRK_JUMP_VX  1
+#include "interp.inc"
+
+#define INTERP_NAME    stepXochip // Octo
+#define INTERP_RUN     runXochip
+#define INTERP_SCHIP   1
+#define INTERP_XO      1
+#define QUIRK_SHIFT_VY 1
+#define QUIRK_INC_I    1
+#define QUIRK_VF_RESET 0
+#define QUIRK_WRAP     1
+#define QUIRK_JUMP_VX  0
+#include "interp.inc"
+
+EmuStatus Emulator_step(Emulator* emu) {
+    return emu->step(emu);
+}
+
+EmuStatus Emulator_run(Emulator* emu, int cycles, int* executed) {
+    return emu->run(emu, cycles, executed);
+}
+
+void Emulator_tickTimers(Emulator* emu) {
+    if (emu->delay_timer > 0) {
+        --emu->delay_timer;
+    }
+    if (emu->sound_timer > 0) {
+        --emu->sound_timer;
+    }
+}
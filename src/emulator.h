@@ -0,0 +1,218 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SCREEN_WIDTH  64  // CHIP-8, and the low-res mode of the extensions
+#define SCREEN_HEIGHT 32
+#define HIRES_WIDTH   128 // SUPER-CHIP / XO-CHIP high-res mode
+#define HIRES_HEIGHT  64
+#define SCREEN_PLANES 2   // XO-CHIP bitplanes; the others only draw to plane 0
+#define ROW_WORDS     (HIRES_WIDTH / 64)
+
+#define MEMORY_SIZE     4096
+#define XO_MEMORY_SIZE  0x10000 // 64K
+#define ROM_OFFSET      0x200   // 512
+#define MAX_ROM_SIZE    (MEMORY_SIZE - ROM_OFFSET)
+#define XO_MAX_ROM_SIZE (XO_MEMORY_SIZE - ROM_OFFSET)
+
+#define STACK_SIZE      16 // a power of two, so the stack pointer can wrap by masking
+#define STACK_MASK      (STACK_SIZE - 1)
+
+#define BIG_FONT_OFFSET 0x50 // SUPER-CHIP 8x10 digits, right after the 4x5 ones
+
+/**
+ * Each platform is also a quirk profile, with its own interpreter compiled
+ * for it (see interp.inc): how shifts, Fx55 / Fx65, logic ops, sprite edges
+ * and Bnnn behave follows the original machine.
+ */
+typedef enum {
+    PLATFORM_CHIP8,  // COSMAC VIP quirks
+    PLATFORM_SCHIP,  // 128x64 mode, scrolling, 16x16 sprites, big font, RPL flags
+    PLATFORM_XOCHIP  // SUPER-CHIP plus 64K memory, two bitplanes and F000 nnnn
+} EmuPlatform;
+
+typedef enum {
+    EMU_OK,
+    EMU_HALTED,         // jumped to itself; nothing more will happen
+    EMU_UNKNOWN_OPCODE,
+    EMU_BAD_KEY,        // SKP / SKNP with a register above 0xF
+    EMU_BAD_FONT        // LD F with a register above 0xF
+} EmuStatus;
+
+/**
+ * The framebuffer, packed one bit per pixel: each row of each plane is
+ * ROW_WORDS words with the leftmost pixel in the most significant bit, so
+ * sprites and scrolls are shifts and memmoves of whole words. Low-res mode
+ * uses the top-left SCREEN_WIDTH x SCREEN_HEIGHT corner.
+ */
+typedef struct {
+    uint64_t rows[SCREEN_PLANES][HIRES_HEIGHT][ROW_WORDS];
+    bool     hires;
+} EmuDisplay;
+
+/**
+ * Per-byte memory access counts, kept while Emulator.heatmap points at
+ * one. Other platforms than XO-CHIP only use the first MEMORY_SIZE bytes.
+ * A byte written after it has been executed is self-modifying code.
+ */
+typedef struct {
+    uint32_t reads[XO_MEMORY_SIZE];    // as data: sprites, Fx65, 5xy3, F002
+    uint32_t writes[XO_MEMORY_SIZE];
+    uint32_t executes[XO_MEMORY_SIZE]; // both bytes of each instruction run
+    uint16_t smcWriter[XO_MEMORY_SIZE]; // pc of the first instruction to rewrite the byte
+    bool     smc[XO_MEMORY_SIZE];
+    uint32_t smcWrites;                // writes to bytes that had already run
+} EmuHeatmap;
+
+typedef struct Emulator {
+    EmuPlatform platform;
+    uint16_t    memoryMask; // addresses wrap at the platform's memory size
+    EmuStatus (*step)(struct Emulator* emu); // the platform's interpreter
+    EmuStatus (*run)(struct Emulator* emu, int cycles, int* executed);
+
+    uint16_t opcode;
+    uint8_t* memory;     // XO_MEMORY_SIZE bytes
+    bool     ownsMemory; // Emulator_free releases memory
+    uint8_t  registers[16];
+    uint16_t I;
+    uint16_t pc;
+
+    EmuDisplay display;
+    uint8_t  planes;    // bitmask of the planes drawn to (Fn01); always 1 before XO-CHIP
+    uint8_t  delay_timer;
+    uint8_t  sound_timer;
+
+    uint16_t stack[STACK_SIZE];
+    uint16_t sp;     // wraps around the stack rather than leaving it
+
+    uint8_t  key[16];
+    bool     waitingForInput;
+    bool     drawFlag;
+
+    uint8_t  flags[16];        // SUPER-CHIP RPL user flags (Fx75 / Fx85)
+    uint8_t  audioPattern[16]; // XO-CHIP F002; kept for frontends, the buzzer ignores it
+    uint8_t  pitch;            // XO-CHIP Fx3A
+    uint32_t rng;              // Cxkk's generator, per machine so runs can be replayed
+
+    // Emulator_run's execution tiers; see emulator.c
+    uint8_t  fusion[XO_MEMORY_SIZE];  // superinstruction starting at each promoted address
+    uint8_t  hotness[XO_MEMORY_SIZE]; // times each cold address has run
+    uint8_t  tierThreshold;           // runs before an address's block is promoted; 0 promotes at once
+    uint32_t promotions;
+    uint32_t demotions;               // promoted code overwritten by Fx33 / Fx55 / 5xy2
+
+    bool     profiling; // time DXYN into drawNs; off by default, it costs two clock reads a sprite
+    uint64_t drawNs;
+
+    // Caller-owned and zeroed; NULL, the default, records nothing. While
+    // set, Emulator_run runs each instruction on its own so all are counted.
+    // Emulator_copy and Emulator_reset leave the pointer as it is
+    EmuHeatmap* heatmap;
+} Emulator;
+
+/**
+ * Allocates guest memory and resets the machine as the given platform.
+ * Returns false if out of memory. Release it with Emulator_free.
+ */
+bool Emulator_init(Emulator* emu, EmuPlatform platform);
+
+/**
+ * Like Emulator_init, on XO_MEMORY_SIZE bytes of the caller's that outlive
+ * the machine; Emulator_free leaves them alone.
+ */
+void Emulator_initWithMemory(Emulator* emu, EmuPlatform platform, uint8_t* memory);
+
+/**
+ * Reboots an initialized machine as the given platform: clears everything
+ * and loads the fonts.
+ */
+void Emulator_reset(Emulator* emu, EmuPlatform platform);
+
+/**
+ * Copies the whole machine state, memory included, between two initialized
+ * machines. Plain struct assignment would share the memory. dst keeps its
+ * own memory and heatmap.
+ */
+void Emulator_copy(Emulator* dst, const Emulator* src);
+
+void Emulator_free(Emulator* emu);
+
+/**
+ * Maps "chip8", "schip" or "xochip" to a platform. Returns false for
+ * anything else.
+ */
+bool Emulator_parsePlatform(const char* name, EmuPlatform* platform);
+
+/**
+ * The name Emulator_parsePlatform takes for platform.
+ */
+const char* Emulator_platformName(EmuPlatform platform);
+
+/**
+ * Picks a platform from a ROM's extension: .sc8 is SUPER-CHIP, .xo8
+ * XO-CHIP and anything else plain CHIP-8.
+ */
+EmuPlatform Emulator_guessPlatform(const char* filename);
+
+/**
+ * The largest ROM the platform can load.
+ */
+size_t Emulator_maxRomSize(const Emulator* emu);
+
+/**
+ * Copies a ROM image to 0x200. Returns false if it doesn't fit.
+ */
+bool Emulator_loadRom(Emulator* emu, const uint8_t* data, size_t size);
+
+/**
+ * Replaces a running ROM of oldSize bytes with a new image, leaving
+ * registers, timers, the stack and the screen alone. Whatever the old ROM
+ * left beyond the new one's end is cleared.
+ */
+bool Emulator_patchRom(Emulator* emu, const uint8_t* data, size_t size, size_t oldSize);
+
+#define TIMER_HZ 60
+
+#define EMU_DEFAULT_TIER_THRESHOLD 16
+#define EMU_DEFAULT_SEED           1
+
+/**
+ * Restarts Cxkk's random sequence. Machines with the same seed draw the
+ * same numbers; Emulator_reset seeds with EMU_DEFAULT_SEED.
+ */
+void Emulator_seed(Emulator* emu, uint32_t seed);
+
+/**
+ * Executes one instruction. Timers are left to Emulator_tickTimers.
+ */
+EmuStatus Emulator_step(Emulator* emu);
+
+/**
+ * Executes up to cycles instructions, stopping early at anything but
+ * EMU_OK, and stores how many ran in executed. Once code has run
+ * tierThreshold times, common instruction sequences in it run as one fused
+ * step, so this is faster than calling Emulator_step in a loop but
+ * otherwise the same, instruction counts included.
+ */
+EmuStatus Emulator_run(Emulator* emu, int cycles, int* executed);
+
+/**
+ * Decrements the delay and sound timers; call it TIMER_HZ times a second
+ * of emulated time. The buzzer is on while sound_timer is non-zero.
+ */
+void Emulator_tickTimers(Emulator* emu);
+
+const char* Emulator_statusName(EmuStatus status);
+
+int EmuDisplay_width(const EmuDisplay* display);
+int EmuDisplay_height(const EmuDisplay* display);
+
+/**
+ * The colour index at (x, y): bit n is set if plane n is lit there.
+ */
+uint8_t EmuDisplay_pixel(const EmuDisplay* display, int x, int y);
+
+#endif
@@ -0,0 +1,119 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heatmap.h"
+
+#define IMAGE_SIZE 512
+
+// How a byte was used, as a bit set
+#define USED_EXECUTE 1
+#define USED_READ    2
+#define USED_WRITE   4
+
+static const char* USE_NAMES[8] = {
+    "-", "code", "data", "code+data", "written", "code+written", "data+written", "code+data+written"
+};
+
+static int useOf(const EmuHeatmap* heatmap, size_t addr) {
+    return (heatmap->executes[addr] ? USED_EXECUTE : 0) |
+           (heatmap->reads[addr]    ? USED_READ    : 0) |
+           (heatmap->writes[addr]   ? USED_WRITE   : 0);
+}
+
+/**
+ * 0-255 for count against the largest, on a log scale so that bytes touched
+ * a handful of times still show next to a main loop run millions of times.
+ */
+static uint8_t intensity(uint32_t count, uint32_t max) {
+    if (count == 0) return 0;
+    return 48 + (uint8_t)(207 * log1p(count) / log1p(max));
+}
+
+static uint32_t largest(const uint32_t* counts, size_t size) {
+    uint32_t max = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (counts[i] > max) max = counts[i];
+    }
+    return max;
+}
+
+bool EmuHeatmap_writePpm(const EmuHeatmap* heatmap, size_t size, const char* filename) {
+    FILE* out = fopen(filename, "wb");
+    if (out == NULL) {
+        printf("Couldn't create %s\n", filename);
+        return false;
+    }
+
+    int      columns    = size > MEMORY_SIZE ? 256 : 64;
+    int      cell       = IMAGE_SIZE / columns;
+    uint32_t maxReads   = largest(heatmap->reads, size);
+    uint32_t maxWrites  = largest(heatmap->writes, size);
+    uint32_t maxExecute = largest(heatmap->executes, size);
+
+    uint8_t* image = calloc(IMAGE_SIZE * IMAGE_SIZE, 3);
+    for (size_t addr = 0; addr < size; addr++) {
+        uint8_t rgb[3];
+        if (heatmap->smc[addr]) {
+            rgb[0] = rgb[1] = rgb[2] = 0xFF;
+        } else {
+            rgb[0] = intensity(heatmap->writes[addr], maxWrites);
+            rgb[1] = intensity(heatmap->executes[addr], maxExecute);
+            rgb[2] = intensity(heatmap->reads[addr], maxReads);
+        }
+
+        int x0 = (addr % columns) * cell;
+        int y0 = (addr / columns) * cell;
+        for (int y = y0; y < y0 + cell; y++) {
+            for (int x = x0; x < x0 + cell; x++) {
+                memcpy(image + (y * IMAGE_SIZE + x) * 3, rgb, 3);
+            }
+        }
+    }
+
+    fprintf(out, "P6\n%d %d\n255\n", IMAGE_SIZE, IMAGE_SIZE);
+    fwrite(image, 3, IMAGE_SIZE * IMAGE_SIZE, out);
+    free(image);
+    if (fclose(out) != 0) {
+        printf("Failed to write %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+void EmuHeatmap_writeReport(const EmuHeatmap* heatmap, size_t size, FILE* out) {
+    fprintf(out, "Range          Use                 Executes       Reads      Writes\n");
+    size_t start = 0;
+    while (start < size) {
+        int    use = useOf(heatmap, start);
+        size_t end = start + 1;
+        while (end < size && useOf(heatmap, end) == use) end++;
+
+        if (use != 0) {
+            uint64_t executes = 0, reads = 0, writes = 0;
+            for (size_t i = start; i < end; i++) {
+                executes += heatmap->executes[i];
+                reads    += heatmap->reads[i];
+                writes   += heatmap->writes[i];
+            }
+            fprintf(out, "%04zX-%04zX      %-17s %10llu  %10llu  %10llu\n", start, end - 1, USE_NAMES[use],
+                    (unsigned long long)executes, (unsigned long long)reads, (unsigned long long)writes);
+        }
+        start = end;
+    }
+
+    int smcBytes = 0;
+    for (size_t addr = 0; addr < size; addr++) {
+        if (!heatmap->smc[addr]) continue;
+        if (smcBytes++ == 0) fprintf(out, "\nSelf-modifying code:\n");
+        fprintf(out, "%04zX  rewritten by the instruction at %04X, executed %u times, written %u\n", addr,
+                heatmap->smcWriter[addr], heatmap->executes[addr], heatmap->writes[addr]);
+    }
+
+    if (smcBytes == 0) {
+        fprintf(out, "\nNo self-modifying code: safe to keep predecoded\n");
+    } else {
+        fprintf(out, "\n%d self-modifying bytes, %u writes to them: predecoded blocks over them get demoted\n",
+                smcBytes, heatmap->smcWrites);
+    }
+}
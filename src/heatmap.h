@@ -0,0 +1,25 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "emulator.h"
+
+/**
+ * Writes the first size bytes of heatmap (MEMORY_SIZE or XO_MEMORY_SIZE) as
+ * a binary PPM, one square per byte in rows of 64 (256 for 64K): red for
+ * writes, green for executes, blue for reads, each on a log scale against
+ * its busiest byte. Self-modifying bytes are white. Prints why and returns
+ * false if the file can't be written.
+ */
+bool EmuHeatmap_writePpm(const EmuHeatmap* heatmap, size_t size, const char* filename);
+
+/**
+ * Lists the touched ranges of memory, grouped by how they were used, then
+ * every self-modifying byte with the instruction that first rewrote it, and
+ * ends with whether the ROM is safe to keep predecoded.
+ */
+void EmuHeatmap_writeReport(const EmuHeatmap* heatmap, size_t size, FILE* out);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "input.h"
+
+#define NOT_DUE INT_MAX
+
+bool Input_init(Input* input) {
+    memset(input, 0, sizeof(Input));
+    return Ring_init(&input->queue, sizeof(InputEvent), INPUT_QUEUE_SIZE);
+}
+
+void Input_free(Input* input) {
+    Ring_free(&input->queue);
+}
+
+bool Input_push(Input* input, SDL_Keycode key, bool down) {
+    InputEvent event;
+    event.key  = key;
+    event.down = down;
+    event.time = SDL_GetPerformanceCounter();
+    if (Ring_push(&input->queue, &event, 1) == 1) return true;
+    input->dropped++;
+    return false;
+}
+
+void Input_beginFrame(Input* input, int cycles) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    input->windowStart = input->windowEnd ? input->windowEnd : now - SDL_GetPerformanceFrequency() / 60;
+    input->windowEnd   = now;
+
+    // Drop what was applied last frame; keep what arrived too late for it
+    uint32_t kept = 0;
+    for (uint32_t i = input->nextPending; i < input->pendingCount; i++) {
+        input->pending[kept++] = input->pending[i];
+    }
+    input->pendingCount = kept;
+    input->nextPending  = 0;
+
+    input->pendingCount += Ring_pop(&input->queue, input->pending + kept, INPUT_QUEUE_SIZE - kept);
+
+    uint64_t span = input->windowEnd - input->windowStart;
+    for (uint32_t i = 0; i < input->pendingCount; i++) {
+        uint64_t t = input->pending[i].time;
+        if (t >= input->windowEnd) {
+            input->offsets[i] = NOT_DUE; // arrived after this frame's window closed
+        } else if (t <= input->windowStart || span == 0) {
+            input->offsets[i] = 0;
+        } else {
+            input->offsets[i] = (int)((t - input->windowStart) * cycles / span);
+        }
+    }
+}
+
+static void record(Input* input, InputEvent* event) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    double   ms  = (double)(now - event->time) * 1000.0 / SDL_GetPerformanceFrequency();
+
+    input->count++;
+    input->totalMs += ms;
+    if (ms > input->maxMs) input->maxMs = ms;
+    int bucket = (int)(ms * 4);
+    input->histogram[bucket < INPUT_HISTO_BUCKETS ? bucket : INPUT_HISTO_BUCKETS]++;
+}
+
+bool Input_next(Input* input, int cycle, InputEvent* event) {
+    if (input->nextPending == input->pendingCount) return false;
+
+    int offset = input->offsets[input->nextPending];
+    if (offset == NOT_DUE || offset > cycle) return false;
+
+    *event = input->pending[input->nextPending++];
+    record(input, event);
+    return true;
+}
+
+int Input_nextCycle(const Input* input) {
+    if (input->nextPending == input->pendingCount) return INPUT_FLUSH;
+    return input->offsets[input->nextPending]; // NOT_DUE is INPUT_FLUSH
+}
+
+static double percentile(Input* input, double p) {
+    uint64_t target = (uint64_t)(input->count * p);
+    uint64_t seen   = 0;
+    for (int i = 0; i <= INPUT_HISTO_BUCKETS; i++) {
+        seen += input->histogram[i];
+        if (seen > target) return (i + 1) / 4.0;
+    }
+    return input->maxMs;
+}
+
+void Input_printStats(Input* input) {
+    if (input->count == 0) {
+        printf("Input: no events\n");
+        return;
+    }
+    printf("Input: %llu events, latency avg %.2f ms, p50 <%.2f ms, p99 <%.2f ms, max %.2f ms, %u dropped\n",
+           (unsigned long long)input->count, input->totalMs / input->count,
+           percentile(input, 0.50), percentile(input, 0.99), input->maxMs, input->dropped);
+}
@@ -0,0 +1,76 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <SDL2/sdl.h>
+
+#include "ring.h"
+
+#define INPUT_QUEUE_SIZE   256
+#define INPUT_FLUSH        INT_MAX // as a cycle: everything due this frame
+#define INPUT_HISTO_BUCKETS 400    // quarter-millisecond buckets, 0-100 ms
+
+typedef struct {
+    SDL_Keycode key;
+    bool        down;
+    uint64_t    time; // SDL_GetPerformanceCounter() when the event was polled
+} InputEvent;
+
+/**
+ * Carries key events from the thread that polls SDL to the emulation
+ * thread, which applies each one at the cycle matching when it arrived.
+ *
+ * Emulation runs one frame behind the wall clock: the frame that starts
+ * at time T replays [previous start, T), so an event that arrived 40% of
+ * the way through that window is applied before 40% of the frame's
+ * cycles have run. Latency is therefore bounded by about one frame.
+ */
+typedef struct {
+    Ring       queue;        // poll thread -> emulation thread
+    InputEvent pending[INPUT_QUEUE_SIZE];
+    int        offsets[INPUT_QUEUE_SIZE]; // cycle each pending event is due at
+    uint32_t   pendingCount;
+    uint32_t   nextPending;
+    uint64_t   windowStart;
+    uint64_t   windowEnd;
+
+    // Arrival-to-applied latency
+    uint64_t   count;
+    uint32_t   dropped;      // poll thread only
+    double     totalMs;
+    double     maxMs;
+    uint32_t   histogram[INPUT_HISTO_BUCKETS + 1];
+} Input;
+
+bool Input_init(Input* input);
+void Input_free(Input* input);
+
+/**
+ * Poll thread: timestamps and queues a key event. Never blocks; returns
+ * false if the queue is full and the event was dropped.
+ */
+bool Input_push(Input* input, SDL_Keycode key, bool down);
+
+/**
+ * Emulation thread: takes the newly arrived events and works out which of
+ * the frame's cycles each one belongs to.
+ */
+void Input_beginFrame(Input* input, int cycles);
+
+/**
+ * Emulation thread: returns the next event due at or before cycle, in
+ * arrival order. Call with INPUT_FLUSH at the end of the frame.
+ */
+bool Input_next(Input* input, int cycle, InputEvent* event);
+
+/**
+ * Emulation thread: the cycle the next pending event is due at, or
+ * INPUT_FLUSH if nothing else is due this frame.
+ */
+int Input_nextCycle(const Input* input);
+
+void Input_printStats(Input* input);
+
+#endif
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "metrics.h"
+
+static double ticksToMs(uint64_t ticks) {
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+bool Metrics_init(Metrics* metrics, const char* logPath) {
+    memset(metrics, 0, sizeof(*metrics));
+    atomic_init(&metrics->instructions, 0);
+    atomic_init(&metrics->frames, 0);
+    atomic_init(&metrics->runTicks, 0);
+    atomic_init(&metrics->drawNs, 0);
+
+    if (logPath != NULL) {
+        metrics->log = fopen(logPath, "a");
+        if (metrics->log == NULL) {
+            printf("Couldn't open %s for metrics\n", logPath);
+            return false;
+        }
+    }
+
+    metrics->start       = SDL_GetPerformanceCounter();
+    metrics->windowStart = metrics->start;
+    metrics->lastFrame   = metrics->start;
+    return true;
+}
+
+void Metrics_free(Metrics* metrics) {
+    if (metrics->log != NULL) fclose(metrics->log);
+    metrics->log = NULL;
+}
+
+void Metrics_addEmulation(Metrics* metrics, uint32_t instructions, uint64_t runTicks, uint64_t drawNs) {
+    atomic_fetch_add_explicit(&metrics->instructions, instructions, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics->frames, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics->runTicks, runTicks, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics->drawNs, drawNs, memory_order_relaxed);
+}
+
+static double percentile(Metrics* metrics, double p) {
+    uint64_t target = (uint64_t)(metrics->hostFrames * p);
+    uint64_t seen   = 0;
+    for (int i = 0; i <= METRICS_HISTO_BUCKETS; i++) {
+        seen += metrics->histogram[i];
+        if (seen > target) return (i + 1) / 10.0;
+    }
+    return metrics->maxMs;
+}
+
+static void writeReport(FILE* log, const MetricsReport* r) {
+    fprintf(log, "{\"t\":%.3f,\"instructions\":%llu,\"mips\":%.3f,\"frames\":%u,\"host_frames\":%u,"
+                 "\"p50_ms\":%.1f,\"p99_ms\":%.1f,\"dispatch_ms\":%.3f,\"draw_ms\":%.3f,"
+                 "\"present_ms\":%.3f,\"events_ms\":%.3f}\n",
+            r->seconds, (unsigned long long)r->instructions, r->mips, r->frames, r->hostFrames,
+            r->p50Ms, r->p99Ms, r->dispatchMs, r->drawMs, r->presentMs, r->eventsMs);
+    fflush(log); // for whoever tails it
+}
+
+bool Metrics_addFrame(Metrics* metrics, uint64_t presentTicks, uint64_t eventsTicks) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    double   ms  = ticksToMs(now - metrics->lastFrame);
+    metrics->lastFrame = now;
+
+    metrics->hostFrames++;
+    metrics->presentTicks += presentTicks;
+    metrics->eventsTicks  += eventsTicks;
+    if (ms > metrics->maxMs) metrics->maxMs = ms;
+    int bucket = (int)(ms * 10);
+    metrics->histogram[bucket < METRICS_HISTO_BUCKETS ? bucket : METRICS_HISTO_BUCKETS]++;
+
+    double windowMs = ticksToMs(now - metrics->windowStart);
+    if (windowMs < 1000) return false;
+
+    // Scale to exactly one second; the window overshoots by up to a frame
+    double         scale = 1000 / windowMs;
+    MetricsReport* r     = &metrics->report;
+    uint64_t instructions = atomic_exchange_explicit(&metrics->instructions, 0, memory_order_relaxed);
+    uint64_t frames       = atomic_exchange_explicit(&metrics->frames, 0, memory_order_relaxed);
+    double   runMs        = ticksToMs(atomic_exchange_explicit(&metrics->runTicks, 0, memory_order_relaxed));
+    double   drawMs       = atomic_exchange_explicit(&metrics->drawNs, 0, memory_order_relaxed) / 1e6;
+
+    r->seconds      = ticksToMs(now - metrics->start) / 1000;
+    r->instructions = (uint64_t)(instructions * scale);
+    r->frames       = (uint32_t)(frames * scale + 0.5);
+    r->hostFrames   = (uint32_t)(metrics->hostFrames * scale + 0.5);
+    r->mips         = r->instructions / 1e6;
+    r->p50Ms        = percentile(metrics, 0.50);
+    r->p99Ms        = percentile(metrics, 0.99);
+    r->dispatchMs   = (runMs > drawMs ? runMs - drawMs : 0) * scale;
+    r->drawMs       = drawMs * scale;
+    r->presentMs    = ticksToMs(metrics->presentTicks) * scale;
+    r->eventsMs     = ticksToMs(metrics->eventsTicks) * scale;
+    metrics->hasReport = true;
+    if (metrics->log != NULL) writeReport(metrics->log, r);
+
+    metrics->windowStart  = now;
+    metrics->hostFrames   = 0;
+    metrics->presentTicks = 0;
+    metrics->eventsTicks  = 0;
+    metrics->maxMs        = 0;
+    memset(metrics->histogram, 0, sizeof(metrics->histogram));
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <SDL2/sdl.h>
+
+#define METRICS_HISTO_BUCKETS 1000 // tenth-of-a-millisecond buckets, 0-100 ms
+
+/**
+ * One second's worth of measurements. Times are milliseconds spent in
+ * that second, so they read as a share of the 1000 available.
+ */
+typedef struct {
+    double   seconds;      // since Metrics_init, at the end of the window
+    uint64_t instructions;
+    uint32_t frames;       // emulated
+    uint32_t hostFrames;   // presented
+    double   mips;
+    double   p50Ms;        // host frame time
+    double   p99Ms;
+    double   dispatchMs;   // running instructions, sprites excluded
+    double   drawMs;       // DXYN
+    double   presentMs;    // building and submitting the picture, vsync wait excluded
+    double   eventsMs;     // pumping SDL events
+} MetricsReport;
+
+/**
+ * Per-second performance counters. The emulation thread adds to its
+ * counters once per emulated frame; the render thread times its own frames
+ * and, once a second, takes the emulation side's totals, works out the
+ * report and appends it to the log as a JSON line.
+ */
+typedef struct {
+    // Emulation thread -> render thread; reset by the render thread
+    atomic_uint_fast64_t instructions;
+    atomic_uint_fast64_t frames;
+    atomic_uint_fast64_t runTicks; // performance counter ticks in Emulator_run
+    atomic_uint_fast64_t drawNs;
+
+    // Render thread only
+    uint64_t start;
+    uint64_t windowStart;
+    uint64_t lastFrame;
+    uint32_t hostFrames;
+    uint64_t presentTicks;
+    uint64_t eventsTicks;
+    uint32_t histogram[METRICS_HISTO_BUCKETS + 1];
+    double   maxMs;
+
+    FILE*         log;    // NULL to keep the reports in memory only
+    MetricsReport report; // the last complete second
+    bool          hasReport;
+} Metrics;
+
+/**
+ * Starts the first window. logPath (may be NULL) is created or appended to;
+ * prints why and returns false if it can't be opened.
+ */
+bool Metrics_init(Metrics* metrics, const char* logPath);
+void Metrics_free(Metrics* metrics);
+
+/**
+ * Emulation thread: one emulated frame ran instructions instructions in
+ * runTicks performance counter ticks, drawNs nanoseconds of them in DXYN.
+ */
+void Metrics_addEmulation(Metrics* metrics, uint32_t instructions, uint64_t runTicks, uint64_t drawNs);
+
+/**
+ * Render thread: a frame was presented, after presentTicks building it and
+ * eventsTicks pumping events. Returns true when that closed a second and
+ * metrics->report is new.
+ */
+bool Metrics_addFrame(Metrics* metrics, uint64_t presentTicks, uint64_t eventsTicks);
+
+#endif
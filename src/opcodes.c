@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "opcodes.h"
+
+static const char* OP_NAMES[OP_KIND_COUNT] = {
+    [OP_UNKNOWN]  = "???",
+    [OP_CLS]      = "CLS",
+    [OP_RET]      = "RET",
+    [OP_JP]       = "JP",
+    [OP_CALL]     = "CALL",
+    [OP_SE_VB]    = "SE",
+    [OP_SNE_VB]   = "SNE",
+    [OP_SE_VV]    = "SE",
+    [OP_LD_VB]    = "LD",
+    [OP_ADD_VB]   = "ADD",
+    [OP_LD_VV]    = "LD",
+    [OP_OR]       = "OR",
+    [OP_AND]      = "AND",
+    [OP_XOR]      = "XOR",
+    [OP_ADD_VV]   = "ADD",
+    [OP_SUB]      = "SUB",
+    [OP_SHR]      = "SHR",
+    [OP_SUBN]     = "SUBN",
+    [OP_SHL]      = "SHL",
+    [OP_SNE_VV]   = "SNE",
+    [OP_LD_I]     = "LD",
+    [OP_JP_V0]    = "JP",
+    [OP_RND]      = "RND",
+    [OP_DRW]      = "DRW",
+    [OP_SKP]      = "SKP",
+    [OP_SKNP]     = "SKNP",
+    [OP_LD_V_DT]  = "LD",
+    [OP_LD_V_K]   = "LD",
+    [OP_LD_DT_V]  = "LD",
+    [OP_LD_ST_V]  = "LD",
+    [OP_ADD_I_V]  = "ADD",
+    [OP_LD_F_V]   = "LD",
+    [OP_LD_B_V]   = "LD",
+    [OP_LD_MEM_V] = "LD",
+    [OP_LD_V_MEM] = "LD",
+    [OP_SCD]      = "SCD",
+    [OP_SCR]      = "SCR",
+    [OP_SCL]      = "SCL",
+    [OP_EXIT]     = "EXIT",
+    [OP_LOW]      = "LOW",
+    [OP_HIGH]     = "HIGH",
+    [OP_LD_HF_V]  = "LD",
+    [OP_LD_R_V]   = "LD",
+    [OP_LD_V_R]   = "LD",
+    [OP_SCU]      = "SCU",
+    [OP_SAVE_VV]  = "LD",
+    [OP_LOAD_VV]  = "LD",
+    [OP_LD_I_LONG] = "LD",
+    [OP_PLANE]    = "PLANE",
+    [OP_AUDIO]    = "AUDIO",
+    [OP_PITCH]    = "PITCH",
+};
+
+static uint8_t kindTable[0x10000];
+static bool    kindTableReady = false;
+
+static OpKind decode(uint16_t opcode) {
+    uint8_t z  = (opcode & 0x000F);
+    uint8_t yz = (opcode & 0x00FF);
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (opcode == 0x00E0) return OP_CLS;
+            if (opcode == 0x00EE) return OP_RET;
+            if (opcode == 0x00FB) return OP_SCR;
+            if (opcode == 0x00FC) return OP_SCL;
+            if (opcode == 0x00FD) return OP_EXIT;
+            if (opcode == 0x00FE) return OP_LOW;
+            if (opcode == 0x00FF) return OP_HIGH;
+            if ((opcode & 0xFFF0) == 0x00C0) return OP_SCD;
+            if ((opcode & 0xFFF0) == 0x00D0) return OP_SCU;
+            return OP_UNKNOWN;
+        case 0x1000: return OP_JP;
+        case 0x2000: return OP_CALL;
+        case 0x3000: return OP_SE_VB;
+        case 0x4000: return OP_SNE_VB;
+        case 0x5000: {
+            if (z == 0) return OP_SE_VV;
+            if (z == 2) return OP_SAVE_VV;
+            if (z == 3) return OP_LOAD_VV;
+            return OP_UNKNOWN;
+        }
+        case 0x6000: return OP_LD_VB;
+        case 0x7000: return OP_ADD_VB;
+        case 0x8000: {
+            switch (z) {
+                case 0x0: return OP_LD_VV;
+                case 0x1: return OP_OR;
+                case 0x2: return OP_AND;
+                case 0x3: return OP_XOR;
+                case 0x4: return OP_ADD_VV;
+                case 0x5: return OP_SUB;
+                case 0x6: return OP_SHR;
+                case 0x7: return OP_SUBN;
+                case 0xE: return OP_SHL;
+            }
+            return OP_UNKNOWN;
+        }
+        case 0x9000: return z == 0 ? OP_SNE_VV : OP_UNKNOWN;
+        case 0xA000: return OP_LD_I;
+        case 0xB000: return OP_JP_V0;
+        case 0xC000: return OP_RND;
+        case 0xD000: return OP_DRW;
+        case 0xE000: {
+            if (yz == 0x9E) return OP_SKP;
+            if (yz == 0xA1) return OP_SKNP;
+            return OP_UNKNOWN;
+        }
+        case 0xF000: {
+            if (opcode == 0xF000) return OP_LD_I_LONG;
+            if (opcode == 0xF002) return OP_AUDIO;
+            switch (yz) {
+                case 0x01: return OP_PLANE;
+                case 0x07: return OP_LD_V_DT;
+                case 0x0A: return OP_LD_V_K;
+                case 0x15: return OP_LD_DT_V;
+                case 0x18: return OP_LD_ST_V;
+                case 0x1E: return OP_ADD_I_V;
+                case 0x29: return OP_LD_F_V;
+                case 0x30: return OP_LD_HF_V;
+                case 0x33: return OP_LD_B_V;
+                case 0x3A: return OP_PITCH;
+                case 0x55: return OP_LD_MEM_V;
+                case 0x65: return OP_LD_V_MEM;
+                case 0x75: return OP_LD_R_V;
+                case 0x85: return OP_LD_V_R;
+            }
+            return OP_UNKNOWN;
+        }
+    }
+    return OP_UNKNOWN;
+}
+
+static void buildKindTable() {
+    for (uint32_t op = 0; op < 0x10000; op++) {
+        kindTable[op] = decode(op);
+    }
+    kindTableReady = true;
+}
+
+OpKind Opcode_kind(uint16_t opcode) {
+    if (!kindTableReady) buildKindTable();
+    return kindTable[opcode];
+}
+
+const char* Opcode_name(OpKind kind) {
+    return kind < OP_KIND_COUNT ? OP_NAMES[kind] : OP_NAMES[OP_UNKNOWN];
+}
+
+int Opcode_format(char* buf, size_t size, uint16_t opcode, const char* target) {
+    uint16_t addr = (opcode & 0x0FFF);
+    uint8_t  x    = (opcode & 0x0F00) >> 8;
+    uint8_t  y    = (opcode & 0x00F0) >> 4;
+    uint8_t  z    = (opcode & 0x000F);
+    uint8_t  yz   = (opcode & 0x00FF);
+
+    char addrText[16];
+    if (target == NULL) {
+        snprintf(addrText, sizeof(addrText), "0x%04X", addr);
+        target = addrText;
+    }
+
+    switch (Opcode_kind(opcode)) {
+        case OP_CLS:      return snprintf(buf, size, "CLS");
+        case OP_RET:      return snprintf(buf, size, "RET");
+        case OP_JP:       return snprintf(buf, size, "JP   %s", target);
+        case OP_CALL:     return snprintf(buf, size, "CALL %s", target);
+        case OP_SE_VB:    return snprintf(buf, size, "SE   V%d,\t%d", x, yz);
+        case OP_SNE_VB:   return snprintf(buf, size, "SNE  V%d,\t%d", x, yz);
+        case OP_SE_VV:    return snprintf(buf, size, "SE   V%d,\tV%d", x, y);
+        case OP_LD_VB:    return snprintf(buf, size, "LD   V%d,\t%d", x, yz);
+        case OP_ADD_VB:   return snprintf(buf, size, "ADD  V%d,\t%d", x, yz);
+        case OP_LD_VV:    return snprintf(buf, size, "LD   V%d,\tV%d", x, y);
+        case OP_OR:       return snprintf(buf, size, "OR   V%d,\tV%d", x, y);
+        case OP_AND:      return snprintf(buf, size, "AND  V%d,\tV%d", x, y);
+        case OP_XOR:      return snprintf(buf, size, "XOR  V%d,\tV%d", x, y);
+        case OP_ADD_VV:   return snprintf(buf, size, "ADD  V%d,\tV%d", x, y);
+        case OP_SUB:      return snprintf(buf, size, "SUB  V%d,\tV%d", x, y);
+        case OP_SHR:      return snprintf(buf, size, "SHR  V%d,\t{V%d}", x, y);
+        case OP_SUBN:     return snprintf(buf, size, "SUBN V%d,\tV%d", x, y);
+        case OP_SHL:      return snprintf(buf, size, "SHL  V%d,\t{V%d}", x, y);
+        case OP_SNE_VV:   return snprintf(buf, size, "SNE  V%d,\tV%d", x, y);
+        case OP_LD_I:     return snprintf(buf, size, "LD   I,\t%s", target);
+        case OP_JP_V0:    return snprintf(buf, size, "JP   V0\t%s", target);
+        case OP_RND:      return snprintf(buf, size, "RND  V%d,\t%d", x, yz);
+        case OP_DRW:      return snprintf(buf, size, "DRW  V%d,\tV%d,\t%d", x, y, z);
+        case OP_SKP:      return snprintf(buf, size, "SKP  V%d", x);
+        case OP_SKNP:     return snprintf(buf, size, "SKNP V%d", x);
+        case OP_LD_V_DT:  return snprintf(buf, size, "LD   V%d,\tDT", x);
+        case OP_LD_V_K:   return snprintf(buf, size, "LD   V%d\tK", x);
+        case OP_LD_DT_V:  return snprintf(buf, size, "LD   DT,\tV%d", x);
+        case OP_LD_ST_V:  return snprintf(buf, size, "LD   ST,\tV%d", x);
+        case OP_ADD_I_V:  return snprintf(buf, size, "ADD  I,\tV%d", x);
+        case OP_LD_F_V:   return snprintf(buf, size, "LD   F,\tV%d", x);
+        case OP_LD_B_V:   return snprintf(buf, size, "LD   B,\tV%d", x);
+        case OP_LD_MEM_V: return snprintf(buf, size, "LD   [I]\tV%d", x);
+        case OP_LD_V_MEM: return snprintf(buf, size, "LD   V%d\t[I]", x);
+        case OP_SCD:      return snprintf(buf, size, "SCD  %d", z);
+        case OP_SCR:      return snprintf(buf, size, "SCR");
+        case OP_SCL:      return snprintf(buf, size, "SCL");
+        case OP_EXIT:     return snprintf(buf, size, "EXIT");
+        case OP_LOW:      return snprintf(buf, size, "LOW");
+        case OP_HIGH:     return snprintf(buf, size, "HIGH");
+        case OP_LD_HF_V:  return snprintf(buf, size, "LD   HF,\tV%d", x);
+        case OP_LD_R_V:   return snprintf(buf, size, "LD   R,\tV%d", x);
+        case OP_LD_V_R:   return snprintf(buf, size, "LD   V%d,\tR", x);
+        case OP_SCU:      return snprintf(buf, size, "SCU  %d", z);
+        case OP_SAVE_VV:  return snprintf(buf, size, "LD   [I],\tV%d-V%d", x, y);
+        case OP_LOAD_VV:  return snprintf(buf, size, "LD   V%d-V%d,\t[I]", x, y);
+        case OP_LD_I_LONG: return snprintf(buf, size, "LD   I,\tLONG");
+        case OP_PLANE:    return snprintf(buf, size, "PLANE %d", x);
+        case OP_AUDIO:    return snprintf(buf, size, "AUDIO");
+        case OP_PITCH:    return snprintf(buf, size, "PITCH V%d", x);
+        default:          return snprintf(buf, size, "Unknown opcode");
+    }
+}
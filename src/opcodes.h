@@ -0,0 +1,82 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    OP_UNKNOWN,
+    OP_CLS,       // 00E0
+    OP_RET,       // 00EE
+    OP_JP,        // 1nnn
+    OP_CALL,      // 2nnn
+    OP_SE_VB,     // 3xkk
+    OP_SNE_VB,    // 4xkk
+    OP_SE_VV,     // 5xy0
+    OP_LD_VB,     // 6xkk
+    OP_ADD_VB,    // 7xkk
+    OP_LD_VV,     // 8xy0
+    OP_OR,        // 8xy1
+    OP_AND,       // 8xy2
+    OP_XOR,       // 8xy3
+    OP_ADD_VV,    // 8xy4
+    OP_SUB,       // 8xy5
+    OP_SHR,       // 8xy6
+    OP_SUBN,      // 8xy7
+    OP_SHL,       // 8xyE
+    OP_SNE_VV,    // 9xy0
+    OP_LD_I,      // Annn
+    OP_JP_V0,     // Bnnn
+    OP_RND,       // Cxkk
+    OP_DRW,       // Dxyn
+    OP_SKP,       // Ex9E
+    OP_SKNP,      // ExA1
+    OP_LD_V_DT,   // Fx07
+    OP_LD_V_K,    // Fx0A
+    OP_LD_DT_V,   // Fx15
+    OP_LD_ST_V,   // Fx18
+    OP_ADD_I_V,   // Fx1E
+    OP_LD_F_V,    // Fx29
+    OP_LD_B_V,    // Fx33
+    OP_LD_MEM_V,  // Fx55
+    OP_LD_V_MEM,  // Fx65
+
+    // SUPER-CHIP
+    OP_SCD,       // 00Cn
+    OP_SCR,       // 00FB
+    OP_SCL,       // 00FC
+    OP_EXIT,      // 00FD
+    OP_LOW,       // 00FE
+    OP_HIGH,      // 00FF
+    OP_LD_HF_V,   // Fx30
+    OP_LD_R_V,    // Fx75
+    OP_LD_V_R,    // Fx85
+
+    // XO-CHIP
+    OP_SCU,       // 00Dn
+    OP_SAVE_VV,   // 5xy2
+    OP_LOAD_VV,   // 5xy3
+    OP_LD_I_LONG, // F000 nnnn, the only four-byte instruction
+    OP_PLANE,     // Fn01
+    OP_AUDIO,     // F002
+    OP_PITCH,     // Fx3A
+    OP_KIND_COUNT
+} OpKind;
+
+/**
+ * Classifies an opcode, accepting the SUPER-CHIP and XO-CHIP extensions,
+ * with a single lookup into a 64K-entry table that is built on first use.
+ * Call it once before sharing it between threads.
+ */
+OpKind Opcode_kind(uint16_t opcode);
+
+const char* Opcode_name(OpKind kind);
+
+/**
+ * Writes the disassembly of opcode (without a trailing newline) into buf and
+ * returns its length. If target is not NULL it replaces the numeric address
+ * operand of JP, CALL, LD I and JP V0.
+ */
+int Opcode_format(char* buf, size_t size, uint16_t opcode, const char* target);
+
+#endif
@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "emulator.h"
+#include "phosphor.h"
+
+bool Phosphor_init(Phosphor* phosphor, int width, int height, double decay) {
+    phosphor->width  = width;
+    phosphor->height = height;
+    phosphor->decay  = decay < 0 ? 0 : decay > 1 ? 1 : decay;
+    phosphor->fading = false;
+    phosphor->glow   = calloc((size_t)width * height, sizeof(uint32_t));
+    return phosphor->glow != NULL;
+}
+
+void Phosphor_free(Phosphor* phosphor) {
+    free(phosphor->glow);
+    phosphor->glow = NULL;
+}
+
+/*
+ * Each channel of the glow is multiplied by keep/256 in 16 bits, then the
+ * brighter of it and the picture's channel kept. Alpha is FF on both, so
+ * it stays. The vector versions take 8 (AVX2) or 4 (SSE2) pixels at once;
+ * unpacking and packing both work within 128-bit lanes, so the pixels come
+ * back in order.
+ */
+bool Phosphor_update(Phosphor* phosphor, const uint32_t* picture, bool changed, double seconds) {
+    if (!changed && !phosphor->fading) return false;
+
+    double kept = pow(phosphor->decay, seconds * TIMER_HZ);
+    int    keep = (int)(kept * 256);
+    if (keep > 255) keep = 255; // 256 would never quite reach the picture
+
+    uint32_t* glow   = phosphor->glow;
+    size_t    count  = (size_t)phosphor->width * phosphor->height;
+    size_t    i      = 0;
+    bool      fading = false;
+
+#if defined(__AVX2__)
+    __m256i zero = _mm256_setzero_si256();
+    __m256i k    = _mm256_set1_epi16(keep);
+    __m256i diff = zero;
+    for (; i + 8 <= count; i += 8) {
+        __m256i g  = _mm256_loadu_si256((const __m256i*)(glow + i));
+        __m256i p  = _mm256_loadu_si256((const __m256i*)(picture + i));
+        __m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(g, zero), k), 8);
+        __m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(g, zero), k), 8);
+        __m256i out = _mm256_max_epu8(_mm256_packus_epi16(lo, hi), p);
+        _mm256_storeu_si256((__m256i*)(glow + i), out);
+        diff = _mm256_or_si256(diff, _mm256_xor_si256(out, p));
+    }
+    fading = !_mm256_testz_si256(diff, diff);
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i k    = _mm_set1_epi16(keep);
+    __m128i diff = zero;
+    for (; i + 4 <= count; i += 4) {
+        __m128i g  = _mm_loadu_si128((const __m128i*)(glow + i));
+        __m128i p  = _mm_loadu_si128((const __m128i*)(picture + i));
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), k), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), k), 8);
+        __m128i out = _mm_max_epu8(_mm_packus_epi16(lo, hi), p);
+        _mm_storeu_si128((__m128i*)(glow + i), out);
+        diff = _mm_or_si128(diff, _mm_xor_si128(out, p));
+    }
+    fading = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xFFFF;
+#endif
+
+    for (; i < count; i++) {
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t g = ((glow[i] >> shift & 0xFF) * keep) >> 8;
+            uint32_t p = picture[i] >> shift & 0xFF;
+            out |= (g > p ? g : p) << shift;
+        }
+        glow[i] = out;
+        if (out != picture[i]) fading = true;
+    }
+
+    phosphor->fading = fading;
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef PHOSPHOR_H
+#define PHOSPHOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Persistence for the picture, like the phosphor of a CRT: a pixel that
+ * goes dark fades out over a few frames instead of vanishing, so sprites
+ * that are erased and redrawn with XOR stop flickering. The glow is every
+ * earlier picture, each dimmed by decay for every 60th of a second since,
+ * and the current one, taking the brightest per channel; that only needs
+ * the one buffer.
+ */
+typedef struct {
+    int       width;
+    int       height;
+    uint32_t* glow;   // what's shown, ARGB
+    double    decay;  // share of the brightness left after 1/60 s
+    bool      fading; // glow still differs from the last picture
+} Phosphor;
+
+/**
+ * decay is between 0, no persistence, and 1, which never fades. Returns
+ * false if out of memory.
+ */
+bool Phosphor_init(Phosphor* phosphor, int width, int height, double decay);
+void Phosphor_free(Phosphor* phosphor);
+
+/**
+ * Dims the glow for seconds and brightens it with picture. Does nothing
+ * and returns false if the picture hasn't changed and nothing is fading;
+ * otherwise glow is new.
+ */
+bool Phosphor_update(Phosphor* phosphor, const uint32_t* picture, bool changed, double seconds);
+
+#endif
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+bool EmuPool_init(EmuPool* pool, int capacity) {
+    pool->entries  = calloc(capacity, sizeof(EmuPoolEntry));
+    pool->memory   = calloc(capacity, XO_MEMORY_SIZE);
+    pool->count    = 0;
+    pool->capacity = capacity;
+    if (pool->entries == NULL || pool->memory == NULL) {
+        EmuPool_free(pool);
+        return false;
+    }
+    return true;
+}
+
+void EmuPool_free(EmuPool* pool) {
+    for (int i = 0; i < pool->count; i++) {
+        Emulator_free(&pool->entries[i].emu);
+    }
+    free(pool->entries);
+    free(pool->memory);
+    pool->entries  = NULL;
+    pool->memory   = NULL;
+    pool->count    = 0;
+    pool->capacity = 0;
+}
+
+bool EmuPool_add(EmuPool* pool, const char* filename, const RomDbEntry* settings, int warmFrames) {
+    if (pool->count == pool->capacity) {
+        printf("No room in the pool for %s\n", filename);
+        return false;
+    }
+
+    static uint8_t data[XO_MAX_ROM_SIZE + 1];
+    FILE* in = fopen(filename, "rb");
+    if (in == NULL) {
+        printf("Couldn't open %s\n", filename);
+        return false;
+    }
+    size_t size = fread(data, 1, sizeof(data), in);
+    fclose(in);
+
+    EmuPoolEntry* entry = &pool->entries[pool->count];
+    Emulator_initWithMemory(&entry->emu, settings->profile, pool->memory + (size_t)pool->count * XO_MEMORY_SIZE);
+    if (!Emulator_loadRom(&entry->emu, data, size)) {
+        printf("%s is too big for %s\n", filename, Emulator_platformName(settings->profile));
+        return false;
+    }
+
+    // Past the intro, if asked; a game waiting for a key just waits
+    for (int frame = 0; frame < warmFrames; frame++) {
+        int executed;
+        if (Emulator_run(&entry->emu, settings->cyclesPerFrame, &executed) != EMU_OK) break;
+        Emulator_tickTimers(&entry->emu);
+    }
+
+    const char* slash = strrchr(filename, '/');
+    snprintf(entry->name, sizeof(entry->name), "%s", slash ? slash + 1 : filename);
+    entry->settings     = *settings;
+    entry->romSize      = size;
+    entry->emu.drawFlag = true; // show the game's screen as soon as it starts
+    pool->count++;
+    return true;
+}
+
+const EmuPoolEntry* EmuPool_start(const EmuPool* pool, int index, Emulator* dst) {
+    const EmuPoolEntry* entry = &pool->entries[index];
+    Emulator_copy(dst, &entry->emu);
+    return entry;
+}
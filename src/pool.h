@@ -0,0 +1,54 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "emulator.h"
+#include "romdb.h"
+
+/**
+ * A game ready to start: a machine that has been reset, had its ROM copied
+ * in and maybe run through its intro, and is never run again itself.
+ */
+typedef struct {
+    Emulator   emu;
+    RomDbEntry settings; // what it was booted with
+    size_t     romSize;
+    char       name[64]; // file name, without the directory
+} EmuPoolEntry;
+
+/**
+ * Pre-booted machines, for switching games without loading anything. The
+ * entries are one array and their guest memory one block, XO_MEMORY_SIZE
+ * per game. Starting one is an Emulator_copy into the running machine:
+ * the struct and 64K of memory, a few hundred microseconds at most.
+ */
+typedef struct {
+    EmuPoolEntry* entries;
+    uint8_t*      memory;
+    int           count;
+    int           capacity;
+} EmuPool;
+
+/**
+ * Allocates room for capacity games. Returns false if out of memory.
+ */
+bool EmuPool_init(EmuPool* pool, int capacity);
+void EmuPool_free(EmuPool* pool);
+
+/**
+ * Boots the ROM in filename as settings->profile and runs it for warmFrames
+ * frames of settings->cyclesPerFrame instructions with no keys pressed.
+ * Prints why and returns false if it can't be read or the pool is full.
+ */
+bool EmuPool_add(EmuPool* pool, const char* filename, const RomDbEntry* settings, int warmFrames);
+
+/**
+ * Replaces the machine in dst with a fresh copy of game index and returns
+ * its entry. dst must have been set up with Emulator_init.
+ */
+const EmuPoolEntry* EmuPool_start(const EmuPool* pool, int index, Emulator* dst);
+
+#endif
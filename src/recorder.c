@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "recorder.h"
+
+#define ENCODER_IDLE_NS 5000000 // 5 ms; a frame comes at most every 16
+
+static void putU16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static void putU32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (i * 8)) & 0xFF;
+    }
+}
+
+static uint32_t getU32(const uint8_t* in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static void packDisplay(const EmuDisplay* display, uint8_t* out) {
+    for (int plane = 0; plane < SCREEN_PLANES; plane++) {
+        for (int y = 0; y < HIRES_HEIGHT; y++) {
+            for (int w = 0; w < ROW_WORDS; w++) {
+                uint64_t word = display->rows[plane][y][w];
+                for (int i = 0; i < 8; i++) {
+                    *out++ = word >> (56 - i * 8);
+                }
+            }
+        }
+    }
+}
+
+static void unpackDisplay(const uint8_t* in, EmuDisplay* display) {
+    for (int plane = 0; plane < SCREEN_PLANES; plane++) {
+        for (int y = 0; y < HIRES_HEIGHT; y++) {
+            for (int w = 0; w < ROW_WORDS; w++) {
+                uint64_t word = 0;
+                for (int i = 0; i < 8; i++) {
+                    word = word << 8 | *in++;
+                }
+                display->rows[plane][y][w] = word;
+            }
+        }
+    }
+}
+
+/**
+ * Run-length codes the XOR of frame and previous into out and returns the
+ * length. Between two frames of a game most of it is zero.
+ */
+static size_t encodeDelta(const uint8_t* frame, const uint8_t* previous, uint8_t* out) {
+    size_t length = 0;
+    int    i = 0;
+    while (i < RECORDING_FRAME_BYTES) {
+        int run = 0;
+        while (i + run < RECORDING_FRAME_BYTES && run < 128 && frame[i + run] == previous[i + run]) {
+            run++;
+        }
+        if (run > 0) {
+            out[length++] = 0x80 | (run - 1);
+            i += run;
+            continue;
+        }
+
+        // Literals up to the next zero pair; a lone zero isn't worth a run
+        int literals = 0;
+        while (i + literals < RECORDING_FRAME_BYTES && literals < 128) {
+            int at = i + literals;
+            if (frame[at] == previous[at] && (at + 1 == RECORDING_FRAME_BYTES || frame[at + 1] == previous[at + 1])) break;
+            literals++;
+        }
+        out[length++] = literals - 1;
+        for (int j = 0; j < literals; j++, i++) {
+            out[length++] = frame[i] ^ previous[i];
+        }
+    }
+    return length;
+}
+
+static void encodeFrame(Recorder* recorder, const RecorderFrame* frame) {
+    uint8_t packed[RECORDING_FRAME_BYTES];
+    uint8_t record[7 + RECORDING_MAX_RECORD];
+
+    packDisplay(&frame->display, packed);
+    size_t length = encodeDelta(packed, recorder->previous, record + 7);
+    memcpy(recorder->previous, packed, sizeof(packed));
+
+    putU32(record, frame->tick);
+    record[4] = frame->display.hires ? 1 : 0;
+    putU16(record + 5, length);
+
+    if (fwrite(record, 1, 7 + length, recorder->out) != 7 + length) {
+        recorder->failed = true;
+        return;
+    }
+    recorder->written++;
+    recorder->bytes += 7 + length;
+}
+
+static void* encoderThread(void* data) {
+    Recorder* recorder = data;
+
+    for (;;) {
+        // Read the flag before draining: anything pushed before stop was set
+        // is then still encoded
+        bool stopping = atomic_load(&recorder->stop);
+
+        RecorderFrame frame;
+        while (Ring_pop(&recorder->queue, &frame, 1) == 1) {
+            if (!recorder->failed) encodeFrame(recorder, &frame);
+        }
+        if (stopping) break;
+
+        struct timespec idle = { 0, ENCODER_IDLE_NS };
+        nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+bool Recorder_open(Recorder* recorder, const char* filename) {
+    recorder->out = fopen(filename, "wb");
+    if (recorder->out == NULL) {
+        printf("Couldn't create %s\n", filename);
+        return false;
+    }
+
+    uint8_t header[5];
+    memcpy(header, RECORDING_MAGIC, 4);
+    header[4] = TIMER_HZ;
+    if (fwrite(header, 1, sizeof(header), recorder->out) != sizeof(header) ||
+            !Ring_init(&recorder->queue, sizeof(RecorderFrame), RECORDER_QUEUE_FRAMES)) {
+        printf("Couldn't start recording to %s\n", filename);
+        fclose(recorder->out);
+        return false;
+    }
+
+    recorder->dropped = 0;
+    recorder->written = 0;
+    recorder->bytes   = sizeof(header);
+    recorder->failed  = false;
+    memset(recorder->previous, 0, sizeof(recorder->previous)); // the first frame is a delta from blank
+    atomic_init(&recorder->stop, false);
+
+    if (pthread_create(&recorder->thread, NULL, encoderThread, recorder) != 0) {
+        printf("Couldn't start the recording thread\n");
+        Ring_free(&recorder->queue);
+        fclose(recorder->out);
+        return false;
+    }
+    return true;
+}
+
+void Recorder_push(Recorder* recorder, const EmuDisplay* display, uint32_t tick) {
+    RecorderFrame frame;
+    frame.display = *display;
+    frame.tick    = tick;
+    if (Ring_push(&recorder->queue, &frame, 1) == 0) recorder->dropped++;
+}
+
+void Recorder_close(Recorder* recorder) {
+    atomic_store(&recorder->stop, true);
+    pthread_join(recorder->thread, NULL);
+
+    if (fclose(recorder->out) != 0) recorder->failed = true;
+    Ring_free(&recorder->queue);
+    if (recorder->failed) printf("Recording failed to write; it is cut short\n");
+}
+
+bool RecordingReader_open(RecordingReader* reader, const char* filename) {
+    reader->in = fopen(filename, "rb");
+    if (reader->in == NULL) {
+        printf("Couldn't open %s\n", filename);
+        return false;
+    }
+
+    uint8_t header[5];
+    if (fread(header, 1, sizeof(header), reader->in) != sizeof(header) || memcmp(header, RECORDING_MAGIC, 4) != 0) {
+        printf("%s isn't a recording\n", filename);
+        fclose(reader->in);
+        return false;
+    }
+    reader->rate = header[4];
+    memset(reader->current, 0, sizeof(reader->current));
+    return true;
+}
+
+bool RecordingReader_next(RecordingReader* reader, EmuDisplay* display, uint32_t* tick) {
+    uint8_t head[7];
+    size_t  got = fread(head, 1, sizeof(head), reader->in);
+    if (got == 0) return false;
+
+    uint8_t record[RECORDING_MAX_RECORD];
+    size_t  length = head[5] | head[6] << 8;
+    if (got != sizeof(head) || length > sizeof(record) || fread(record, 1, length, reader->in) != length) {
+        printf("Recording ends in the middle of a frame\n");
+        return false;
+    }
+
+    size_t i = 0;
+    int    at = 0;
+    while (i < length) {
+        uint8_t control = record[i++];
+        int     count   = (control & 0x7F) + 1;
+        if (at + count > RECORDING_FRAME_BYTES || (control < 0x80 && i + count > length)) {
+            printf("Damaged frame in recording\n");
+            return false;
+        }
+        if (control < 0x80) {
+            for (int j = 0; j < count; j++) {
+                reader->current[at++] ^= record[i++];
+            }
+        } else {
+            at += count;
+        }
+    }
+
+    unpackDisplay(reader->current, display);
+    display->hires = head[4] & 1;
+    *tick = getU32(head);
+    return true;
+}
+
+void RecordingReader_close(RecordingReader* reader) {
+    fclose(reader->in);
+}
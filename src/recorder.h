@@ -0,0 +1,99 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "emulator.h"
+#include "ring.h"
+
+/*
+ * Recordings (.c8v) are a header followed by one record per frame:
+ *
+ *   header  "C8V1", then the frame rate in one byte
+ *   record  tick (u32), flags (u8, bit 0: hires), length (u16), then length
+ *           bytes of the frame XORed with the previous one, run-length coded
+ *
+ * Multi-byte numbers are little-endian. tick is the emulator frame the
+ * picture was shown at, so time keeps its pace across frames that weren't
+ * recorded. A frame is the EmuDisplay rows plane by plane, each row
+ * ROW_WORDS words of 8 bytes with the leftmost pixel in the top bit of the
+ * first byte. The runs are a control byte c then, for c < 0x80, c + 1 bytes
+ * copied as they are, or for c >= 0x80, (c & 0x7F) + 1 zero bytes.
+ */
+#define RECORDING_MAGIC       "C8V1"
+#define RECORDING_FRAME_BYTES (SCREEN_PLANES * HIRES_HEIGHT * ROW_WORDS * 8)
+#define RECORDING_MAX_RECORD  (RECORDING_FRAME_BYTES + RECORDING_FRAME_BYTES / 128 + 1)
+
+// About a second of frames at TIMER_HZ; beyond that the encoder has fallen
+// behind and new frames are dropped
+#define RECORDER_QUEUE_FRAMES 64
+
+typedef struct {
+    EmuDisplay display;
+    uint32_t   tick;
+} RecorderFrame;
+
+/**
+ * Writes frames to a recording on a thread of its own. The presenting
+ * thread only copies each frame into a queue, so it never waits on the
+ * encoder or the disk; when the queue is full the frame is dropped and
+ * counted instead.
+ */
+typedef struct {
+    FILE*       out;
+    Ring        queue;    // RecorderFrame, presenting thread -> encoder thread
+    pthread_t   thread;
+    atomic_bool stop;
+
+    uint32_t    dropped;  // written by the presenting thread only
+    uint32_t    written;  // written by the encoder thread only, read after Recorder_close
+    uint64_t    bytes;
+    bool        failed;   // a write failed; nothing more is written
+
+    uint8_t     previous[RECORDING_FRAME_BYTES]; // encoder thread's last frame
+} Recorder;
+
+/**
+ * Creates the file, writes the header and starts the encoder thread.
+ * Prints why and returns false if any of that fails.
+ */
+bool Recorder_open(Recorder* recorder, const char* filename);
+
+/**
+ * Queues a frame shown at emulator frame tick. Never blocks.
+ */
+void Recorder_push(Recorder* recorder, const EmuDisplay* display, uint32_t tick);
+
+/**
+ * Encodes whatever is still queued, stops the thread and closes the file.
+ */
+void Recorder_close(Recorder* recorder);
+
+/**
+ * Reads a recording back one frame at a time.
+ */
+typedef struct {
+    FILE*   in;
+    uint8_t rate;
+    uint8_t current[RECORDING_FRAME_BYTES];
+} RecordingReader;
+
+/**
+ * Opens a recording and checks its header. Prints why and returns false
+ * if it isn't one.
+ */
+bool RecordingReader_open(RecordingReader* reader, const char* filename);
+
+/**
+ * Decodes the next frame. Returns false at the end of the recording, or
+ * at a damaged record, which is reported.
+ */
+bool RecordingReader_next(RecordingReader* reader, EmuDisplay* display, uint32_t* tick);
+
+void RecordingReader_close(RecordingReader* reader);
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+bool Ring_init(Ring* ring, size_t elemSize, uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    ring->data = malloc(size * elemSize);
+    if (ring->data == NULL) return false;
+    ring->elemSize = elemSize;
+    ring->capacity = size;
+    ring->mask     = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return true;
+}
+
+void Ring_free(Ring* ring) {
+    free(ring->data);
+    ring->data = NULL;
+}
+
+// Copies count elements between a linear buffer and the ring starting at
+// slot, wrapping around the end at most once
+static void copyIn(Ring* ring, uint32_t slot, const uint8_t* src, uint32_t count) {
+    uint32_t first = ring->capacity - slot;
+    if (first > count) first = count;
+    memcpy(ring->data + slot * ring->elemSize, src, first * ring->elemSize);
+    memcpy(ring->data, src + first * ring->elemSize, (count - first) * ring->elemSize);
+}
+
+static void copyOut(Ring* ring, uint32_t slot, uint8_t* dst, uint32_t count) {
+    uint32_t first = ring->capacity - slot;
+    if (first > count) first = count;
+    memcpy(dst, ring->data + slot * ring->elemSize, first * ring->elemSize);
+    memcpy(dst + first * ring->elemSize, ring->data, (count - first) * ring->elemSize);
+}
+
+uint32_t Ring_push(Ring* ring, const void* elems, uint32_t count) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t free = ring->capacity - (tail - head);
+    if (count > free) count = free;
+    if (count == 0) return 0;
+
+    copyIn(ring, tail & ring->mask, elems, count);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+uint32_t Ring_pop(Ring* ring, void* elems, uint32_t count) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t used = tail - head;
+    if (count > used) count = used;
+    if (count == 0) return 0;
+
+    copyOut(ring, head & ring->mask, elems, count);
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+uint32_t Ring_size(Ring* ring) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return tail - head;
+}
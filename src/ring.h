@@ -0,0 +1,52 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RING_CACHE_LINE 64
+
+/**
+ * Lock-free single-producer/single-consumer queue of fixed-size elements.
+ * One thread may push and one other thread may pop at the same time;
+ * neither ever blocks, and nothing is allocated after Ring_init.
+ */
+typedef struct {
+    uint8_t* data;
+    size_t   elemSize;
+    uint32_t capacity; // power of two
+    uint32_t mask;
+
+    // Free-running counters, on separate cache lines so the two threads
+    // don't keep stealing each other's line
+    _Alignas(RING_CACHE_LINE) atomic_uint head; // next slot to pop, written by the consumer
+    _Alignas(RING_CACHE_LINE) atomic_uint tail; // next slot to push, written by the producer
+} Ring;
+
+/**
+ * Allocates room for at least capacity elements (rounded up to a power of
+ * two). Returns false if out of memory.
+ */
+bool Ring_init(Ring* ring, size_t elemSize, uint32_t capacity);
+void Ring_free(Ring* ring);
+
+/**
+ * Producer side. Copies as many of the count elements as fit and returns
+ * how many that was.
+ */
+uint32_t Ring_push(Ring* ring, const void* elems, uint32_t count);
+
+/**
+ * Consumer side. Copies up to count elements out and returns how many.
+ */
+uint32_t Ring_pop(Ring* ring, void* elems, uint32_t count);
+
+/**
+ * Elements waiting to be popped. Exact from either side's own point of
+ * view, approximate from anywhere else.
+ */
+uint32_t Ring_size(Ring* ring);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "romdb.h"
+
+#define MIN_SLOTS 16
+
+uint64_t RomDb_hash(const uint8_t* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull; // FNV-1a
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool RomDb_open(RomDb* db, const char* filename) {
+    memset(db, 0, sizeof(*db));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Couldn't open %s\n", filename);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RomDbHeader)) {
+        printf("%s isn't a ROM index\n", filename);
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Couldn't map %s\n", filename);
+        return false;
+    }
+
+    const RomDbHeader* header = map;
+    uint32_t slots = header->slotCount;
+    if (memcmp(header->magic, ROMDB_MAGIC, 4) != 0 || header->version != ROMDB_VERSION ||
+            slots == 0 || (slots & (slots - 1)) != 0 ||
+            (size_t)st.st_size != sizeof(RomDbHeader) + (size_t)slots * sizeof(RomDbEntry)) {
+        printf("%s isn't a ROM index this version can read; rebuild it with romindex\n", filename);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    db->map     = map;
+    db->mapSize = st.st_size;
+    db->header  = header;
+    db->slots   = (const RomDbEntry*)(header + 1);
+    return true;
+}
+
+void RomDb_close(RomDb* db) {
+    if (db->map != NULL) munmap(db->map, db->mapSize);
+    db->map = NULL;
+}
+
+/**
+ * Whether an entry's settings are ones the frontend can boot with. A file
+ * romindex wrote always passes; a damaged or hand-made one may not.
+ */
+static bool entryValid(const RomDbEntry* entry) {
+    if (entry->platform > PLATFORM_XOCHIP || entry->profile > PLATFORM_XOCHIP) return false;
+    if (entry->cyclesPerFrame == 0) return false;
+    for (size_t i = 0; i < sizeof(entry->keymap); i++) {
+        if (!isgraph((unsigned char)entry->keymap[i])) return false;
+    }
+    return true;
+}
+
+const RomDbEntry* RomDb_find(const RomDb* db, uint64_t hash, uint32_t size) {
+    // romindex always leaves a free slot, but a damaged file may have none,
+    // so the probe stops after one lap
+    uint32_t mask = db->header->slotCount - 1;
+    for (uint32_t n = 0, i = hash & mask; n <= mask; n++, i = (i + 1) & mask) {
+        const RomDbEntry* entry = &db->slots[i];
+        if (entry->size == 0) return NULL;
+        if (entry->hash != hash || entry->size != size) continue;
+
+        if (!entryValid(entry)) {
+            printf("The index entry for %016llx is damaged; ignoring it\n", (unsigned long long)hash);
+            return NULL;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+bool RomDb_write(const char* filename, const RomDbEntry* entries, size_t count, uint32_t* stored) {
+    uint32_t slots = MIN_SLOTS;
+    while (slots < count * 2) slots *= 2;
+
+    RomDbEntry* table = calloc(slots, sizeof(RomDbEntry));
+    if (table == NULL) {
+        printf("Out of memory\n");
+        return false;
+    }
+
+    RomDbHeader header;
+    memcpy(header.magic, ROMDB_MAGIC, 4);
+    header.version    = ROMDB_VERSION;
+    header.slotCount  = slots;
+    header.entryCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const RomDbEntry* entry = &entries[i];
+        uint32_t j = entry->hash & (slots - 1);
+        while (table[j].size != 0 && !(table[j].hash == entry->hash && table[j].size == entry->size)) {
+            j = (j + 1) & (slots - 1);
+        }
+        if (table[j].size != 0) continue; // the same ROM again
+        table[j] = *entry;
+        header.entryCount++;
+    }
+
+    FILE* out = fopen(filename, "wb");
+    if (out == NULL) {
+        printf("Couldn't create %s\n", filename);
+        free(table);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(table, sizeof(RomDbEntry), slots, out) == slots;
+    if (fclose(out) != 0) ok = false;
+    free(table);
+    *stored = header.entryCount;
+    if (!ok) printf("Failed to write %s\n", filename);
+    return ok;
+}
@@ -0,0 +1,77 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "emulator.h"
+
+/*
+ * ROM library index (.db), written by romindex and mapped read-only by the
+ * frontends. A header, then a power-of-two table of fixed-size slots:
+ *
+ *   header  "C8DB", version (u32), slot count (u32), entry count (u32)
+ *   slot    RomDbEntry; size 0 marks an empty one
+ *
+ * Entries sit at their hash modulo the slot count, or in the next free slot
+ * after it, and the table is at most half full, so a lookup is a probe or
+ * two straight into the mapping. Numbers are in the host's byte order: an
+ * index from a machine of the other endianness fails the version check.
+ */
+#define ROMDB_MAGIC   "C8DB"
+#define ROMDB_VERSION 1
+#define ROMDB_KEYS    "0123456789abcdef" // the default keymap: each CHIP-8 key on its own hex digit
+
+typedef struct {
+    char     magic[4];
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t entryCount;
+} RomDbHeader;
+
+typedef struct {
+    uint64_t hash;           // RomDb_hash of the ROM's bytes
+    uint32_t size;
+    uint8_t  platform;       // EmuPlatform the instructions it uses need
+    uint8_t  profile;        // EmuPlatform whose quirks to run it with, never below platform
+    uint16_t cyclesPerFrame; // recommended clock, in instructions per 60 Hz frame
+    char     keymap[16];     // host key for each CHIP-8 key, as the lowercase character on it
+} RomDbEntry;
+
+typedef struct {
+    void*              map;
+    size_t             mapSize;
+    const RomDbHeader* header;
+    const RomDbEntry*  slots;
+} RomDb;
+
+/**
+ * FNV-1a over the ROM's bytes.
+ */
+uint64_t RomDb_hash(const uint8_t* data, size_t size);
+
+/**
+ * Maps an index. Prints why and returns false if it can't be opened or
+ * isn't one.
+ */
+bool RomDb_open(RomDb* db, const char* filename);
+void RomDb_close(RomDb* db);
+
+/**
+ * The entry for the ROM with this hash and size, or NULL if the library
+ * doesn't have it. An entry with a platform or profile past XO-CHIP, no
+ * clock or an unprintable key is damaged: it's reported and NULL returned.
+ * Points into the mapping.
+ */
+const RomDbEntry* RomDb_find(const RomDb* db, uint64_t hash, uint32_t size);
+
+/**
+ * Builds an index of count entries, none of them empty ROMs, and writes it
+ * to filename. Entries with the same hash and size as an earlier one are
+ * left out; stored is set to how many went in. Prints why and returns
+ * false on failure.
+ */
+bool RomDb_write(const char* filename, const RomDbEntry* entries, size_t count, uint32_t* stored);
+
+#endif
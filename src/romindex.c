@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "emulator.h"
+#include "romdb.h"
+#include "cfg.h"
+#include "opcodes.h"
+
+// Recommended instructions per frame for each EmuPlatform: the SDL
+// frontend's default for CHIP-8, faster for the later machines, whose
+// programs were written for faster interpreters
+static const uint16_t DEFAULT_CLOCKS[] = { 10, 30, 100 };
+
+typedef struct {
+    char**      names;
+    RomDbEntry* entries;
+    size_t      count;
+    size_t      capacity;
+} RomList;
+
+static bool isRomName(const char* name) {
+    size_t len = strlen(name);
+    if (len < 4) return false;
+    const char* ext = name + len - 4;
+    return strcasecmp(ext, ".ch8") == 0 || strcasecmp(ext, ".sc8") == 0 || strcasecmp(ext, ".xo8") == 0;
+}
+
+static const char* baseName(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/**
+ * The platform the reachable instructions need. Data is never decoded, so
+ * a sprite that happens to read as 00FF doesn't make a ROM SUPER-CHIP.
+ * Anything past the 4K machine is XO-CHIP.
+ */
+static EmuPlatform detectPlatform(const uint8_t* data, size_t size) {
+    if (size > (size_t)MEMORY_SIZE - ROM_OFFSET) return PLATFORM_XOCHIP;
+
+    static uint8_t memory[CFG_MEM_SZ + 2];
+    memset(memory, 0, sizeof(memory));
+    memcpy(memory + ROM_OFFSET, data, size);
+
+    Cfg cfg;
+    Cfg_init(&cfg);
+    Cfg_build(&cfg, memory, ROM_OFFSET, ROM_OFFSET + size);
+
+    EmuPlatform platform = PLATFORM_CHIP8;
+    for (size_t addr = ROM_OFFSET; addr < ROM_OFFSET + size; addr++) {
+        if (!(cfg.flags[addr] & CFG_INSTR)) continue;
+
+        OpKind kind = Opcode_kind(memory[addr] << 8 | memory[addr + 1]);
+        if (kind >= OP_SCU) {
+            platform = PLATFORM_XOCHIP;
+        } else if (kind >= OP_SCD && platform == PLATFORM_CHIP8) {
+            platform = PLATFORM_SCHIP;
+        }
+    }
+    Cfg_free(&cfg);
+    return platform;
+}
+
+static void addRom(RomList* list, const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        printf("Couldn't open %s\n", path);
+        return;
+    }
+    static uint8_t data[XO_MEMORY_SIZE];
+    size_t size = fread(data, 1, sizeof(data), in);
+    bool   tooBig = fgetc(in) != EOF;
+    fclose(in);
+    if (size == 0 || tooBig || size > (size_t)XO_MEMORY_SIZE - ROM_OFFSET) {
+        printf("Skipping %s: %s\n", path, size == 0 ? "empty" : "too big for any platform");
+        return;
+    }
+
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->names    = realloc(list->names, list->capacity * sizeof(char*));
+        list->entries  = realloc(list->entries, list->capacity * sizeof(RomDbEntry));
+    }
+
+    // The code says more than the extension, but a ROM named .sc8 that only
+    // uses CHIP-8 instructions may still want the SUPER-CHIP quirks
+    EmuPlatform platform = detectPlatform(data, size);
+    EmuPlatform named    = Emulator_guessPlatform(path);
+    if (named > platform) platform = named;
+
+    RomDbEntry* entry = &list->entries[list->count];
+    entry->hash           = RomDb_hash(data, size);
+    entry->size           = size;
+    entry->platform       = platform;
+    entry->profile        = platform;
+    entry->cyclesPerFrame = DEFAULT_CLOCKS[platform];
+    memcpy(entry->keymap, ROMDB_KEYS, sizeof(entry->keymap));
+    list->names[list->count++] = strdup(path);
+}
+
+/**
+ * Adds path if it's a file, or every ROM below it if it's a directory.
+ */
+static void collect(RomList* list, const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        printf("Couldn't open %s\n", path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        addRom(list, path);
+        return;
+    }
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        printf("Couldn't open directory %s\n", path);
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char child[4096];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (stat(child, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode) || isRomName(entry->d_name)) collect(list, child);
+    }
+    closedir(dir);
+}
+
+/**
+ * Applies one "key=value" setting from the tuning file. Returns false if
+ * it isn't one.
+ */
+static bool applySetting(RomDbEntry* entry, char* setting) {
+    char* value = strchr(setting, '=');
+    if (value == NULL) return false;
+    *value++ = '\0';
+
+    EmuPlatform platform;
+    if (strcmp(setting, "platform") == 0 && Emulator_parsePlatform(value, &platform)) {
+        entry->platform = platform;
+        entry->profile  = platform;
+    } else if (strcmp(setting, "quirks") == 0 && Emulator_parsePlatform(value, &platform)) {
+        // The profile is the machine the ROM is booted as, so one below the
+        // platform would lack its memory or instructions
+        if (platform < entry->platform) return false;
+        entry->profile = platform;
+    } else if (strcmp(setting, "cpf") == 0 && atoi(value) > 0 && atoi(value) <= UINT16_MAX) {
+        entry->cyclesPerFrame = atoi(value);
+    } else if (strcmp(setting, "keys") == 0 && strlen(value) == sizeof(entry->keymap)) {
+        for (size_t i = 0; i < sizeof(entry->keymap); i++) {
+            entry->keymap[i] = tolower((unsigned char)value[i]);
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reads hand tuning over what detection found. Each line is a ROM, by file
+ * name or by hash in hex, then settings:
+ *
+ *   Blitz.ch8  quirks=schip cpf=15
+ *   # comments and blank lines are skipped
+ *   7f2e0c3d9a1b4c55  keys=x123qweasdzc4rfv
+ *
+ * platform sets both the platform and the quirks; quirks sets only the
+ * latter and can't go below the platform; keys lists the host key for
+ * CHIP-8 keys 0 to F.
+ */
+static bool applyTuning(RomList* list, const char* filename) {
+    FILE* in = fopen(filename, "r");
+    if (in == NULL) {
+        printf("Couldn't open %s\n", filename);
+        return false;
+    }
+
+    char line[512];
+    int  lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        lineNumber++;
+        char* rom = strtok(line, " \t\r\n");
+        if (rom == NULL || rom[0] == '#') continue;
+
+        char*    end;
+        uint64_t hash   = strtoull(rom, &end, 16);
+        bool     byHash = strlen(rom) == 16 && *end == '\0';
+        int      found  = 0;
+        char*    settings[16];
+        int      settingCount = 0;
+        char*    setting;
+        while ((setting = strtok(NULL, " \t\r\n")) != NULL && settingCount < 16) {
+            settings[settingCount++] = setting;
+        }
+
+        for (size_t i = 0; i < list->count; i++) {
+            if (byHash ? list->entries[i].hash != hash : strcmp(baseName(list->names[i]), rom) != 0) continue;
+            found++;
+            for (int s = 0; s < settingCount; s++) {
+                char copy[128];
+                snprintf(copy, sizeof(copy), "%s", settings[s]);
+                if (!applySetting(&list->entries[i], copy)) {
+                    printf("%s:%d: bad setting %s\n", filename, lineNumber, settings[s]);
+                    ok = false;
+                }
+            }
+        }
+        if (found == 0) printf("%s:%d: no ROM %s in the library\n", filename, lineNumber, rom);
+    }
+    fclose(in);
+    return ok;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* outname    = "roms.db";
+    const char* tuningName = NULL;
+    bool        verbose    = false;
+    RomList     list = { NULL, NULL, 0, 0 };
+
+    if (argc < 2) {
+        printf("Missing argument: ROMs.\nUsage: romindex [-v] [-c tuning.txt] [-o roms.db] <directory or ROM>...\n");
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outname = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            tuningName = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else {
+            collect(&list, argv[i]);
+        }
+    }
+
+    if (tuningName != NULL && !applyTuning(&list, tuningName)) return 1;
+
+    int counts[3] = { 0, 0, 0 };
+    for (size_t i = 0; i < list.count; i++) {
+        const RomDbEntry* entry = &list.entries[i];
+        counts[entry->platform]++;
+        if (verbose) {
+            printf("%016llx %5u %-6s quirks %-6s %4u cpf  %.16s  %s\n", (unsigned long long)entry->hash,
+                   entry->size, Emulator_platformName(entry->platform), Emulator_platformName(entry->profile),
+                   entry->cyclesPerFrame, entry->keymap, list.names[i]);
+        }
+    }
+
+    uint32_t stored;
+    bool     ok = RomDb_write(outname, list.entries, list.count, &stored);
+    if (ok) {
+        printf("Indexed %u ROMs from %zu files (%d CHIP-8, %d SUPER-CHIP, %d XO-CHIP) into %s\n", stored,
+               list.count, counts[PLATFORM_CHIP8], counts[PLATFORM_SCHIP], counts[PLATFORM_XOCHIP], outname);
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.names[i]);
+    }
+    free(list.names);
+    free(list.entries);
+    return ok ? 0 : 1;
+}
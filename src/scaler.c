@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "scaler.h"
+
+/*
+ * The filters work a row at a time on 32-bit ARGB pixels. The ones that
+ * compare neighbours do so VEC_PIXELS pixels at once, with AVX2 when the
+ * compiler targets it (-mavx2, -march=native) and SSE2, which every x86-64
+ * has, otherwise; the block filters use SSE2 shuffles. Other machines get
+ * the plain C below, which the vector code finishes rows with too.
+ */
+
+#define MAX_FILTER_WIDTH (HIRES_WIDTH * 2) // SCALE_4X's second pass
+
+typedef void (*RowFilter)(const uint32_t* up, const uint32_t* row, const uint32_t* down, int width,
+                          uint32_t* out, int stride);
+
+static const char* FILTER_NAMES[SCALE_FILTER_COUNT] = {
+    "none", "scale2x", "scale3x", "scale4x", "scanlines", "lcd"
+};
+static const int FILTER_FACTORS[SCALE_FILTER_COUNT] = { 1, 2, 3, 4, 4, 4 };
+
+#if defined(__AVX2__)
+
+typedef __m256i Vec;
+#define VEC_PIXELS 8
+
+static inline Vec  vecLoad(const uint32_t* p)     { return _mm256_loadu_si256((const __m256i*)p); }
+static inline void vecStore(uint32_t* p, Vec v)    { _mm256_storeu_si256((__m256i*)p, v); }
+static inline Vec  vecEq(Vec a, Vec b)             { return _mm256_cmpeq_epi32(a, b); }
+static inline Vec  vecAnd(Vec a, Vec b)            { return _mm256_and_si256(a, b); }
+static inline Vec  vecAndNot(Vec a, Vec b)         { return _mm256_andnot_si256(a, b); } // ~a & b
+static inline Vec  vecOr(Vec a, Vec b)             { return _mm256_or_si256(a, b); }
+static inline Vec  vecSelect(Vec mask, Vec a, Vec b) { return _mm256_blendv_epi8(b, a, mask); }
+
+// a0 b0 a1 b1 ...; the unpacks work within 128-bit lanes, so put the
+// lanes back in order afterwards
+static inline void vecStorePairs(uint32_t* p, Vec a, Vec b) {
+    Vec lo = _mm256_unpacklo_epi32(a, b);
+    Vec hi = _mm256_unpackhi_epi32(a, b);
+    vecStore(p, _mm256_permute2x128_si256(lo, hi, 0x20));
+    vecStore(p + VEC_PIXELS, _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+#elif defined(__SSE2__)
+
+typedef __m128i Vec;
+#define VEC_PIXELS 4
+
+static inline Vec  vecLoad(const uint32_t* p)     { return _mm_loadu_si128((const __m128i*)p); }
+static inline void vecStore(uint32_t* p, Vec v)    { _mm_storeu_si128((__m128i*)p, v); }
+static inline Vec  vecEq(Vec a, Vec b)             { return _mm_cmpeq_epi32(a, b); }
+static inline Vec  vecAnd(Vec a, Vec b)            { return _mm_and_si128(a, b); }
+static inline Vec  vecAndNot(Vec a, Vec b)         { return _mm_andnot_si128(a, b); } // ~a & b
+static inline Vec  vecOr(Vec a, Vec b)             { return _mm_or_si128(a, b); }
+static inline Vec  vecSelect(Vec mask, Vec a, Vec b) { return vecOr(vecAnd(mask, a), vecAndNot(mask, b)); }
+
+static inline void vecStorePairs(uint32_t* p, Vec a, Vec b) {
+    vecStore(p, _mm_unpacklo_epi32(a, b));
+    vecStore(p + VEC_PIXELS, _mm_unpackhi_epi32(a, b));
+}
+
+#endif
+
+static inline uint32_t dim(uint32_t argb) {
+    return (argb >> 1 & 0x007F7F7F) | (argb & 0xFF000000);
+}
+
+#ifdef __SSE2__
+static inline __m128i dim4(__m128i argb) {
+    __m128i rgb = _mm_and_si128(_mm_srli_epi32(argb, 1), _mm_set1_epi32(0x007F7F7F));
+    return _mm_or_si128(rgb, _mm_and_si128(argb, _mm_set1_epi32((int)0xFF000000)));
+}
+#endif
+
+/**
+ * Scale2x: each pixel E becomes a 2x2 block whose corners take the colour
+ * of the two neighbours they sit between when those match, unless the
+ * pixel is in the middle of a line:
+ *
+ *       B
+ *     D E F   ->   E0 E1
+ *       H          E2 E3
+ */
+static void scale2xRow(const uint32_t* up, const uint32_t* row, const uint32_t* down, int width,
+                       uint32_t* out, int stride) {
+    int x = 0;
+#ifdef VEC_PIXELS
+    for (; x + VEC_PIXELS <= width; x += VEC_PIXELS) {
+        Vec b = vecLoad(up + x);
+        Vec d = vecLoad(row + x - 1);
+        Vec e = vecLoad(row + x);
+        Vec f = vecLoad(row + x + 1);
+        Vec h = vecLoad(down + x);
+
+        Vec corner = vecAndNot(vecEq(b, h), vecAndNot(vecEq(d, f), vecEq(e, e))); // B != H && D != F
+        Vec e0 = vecSelect(vecAnd(corner, vecEq(d, b)), d, e);
+        Vec e1 = vecSelect(vecAnd(corner, vecEq(b, f)), f, e);
+        Vec e2 = vecSelect(vecAnd(corner, vecEq(d, h)), d, e);
+        Vec e3 = vecSelect(vecAnd(corner, vecEq(h, f)), f, e);
+        vecStorePairs(out + x * 2, e0, e1);
+        vecStorePairs(out + stride + x * 2, e2, e3);
+    }
+#endif
+    for (; x < width; x++) {
+        uint32_t b = up[x], d = row[x - 1], e = row[x], f = row[x + 1], h = down[x];
+        bool corner = b != h && d != f;
+        out[x * 2]              = corner && d == b ? d : e;
+        out[x * 2 + 1]          = corner && b == f ? f : e;
+        out[stride + x * 2]     = corner && d == h ? d : e;
+        out[stride + x * 2 + 1] = corner && h == f ? f : e;
+    }
+}
+
+/**
+ * Scale3x: as Scale2x, into 3x3 blocks, and the edge pixels of the block
+ * also follow a diagonal that passes the corner of the neighbourhood:
+ *
+ *     A B C         E0 E1 E2
+ *     D E F   ->    E3 E4 E5
+ *     G H I         E6 E7 E8
+ */
+static void scale3xRow(const uint32_t* up, const uint32_t* row, const uint32_t* down, int width,
+                       uint32_t* out, int stride) {
+    int x = 0;
+#ifdef VEC_PIXELS
+    for (; x + VEC_PIXELS <= width; x += VEC_PIXELS) {
+        Vec a = vecLoad(up + x - 1),   b = vecLoad(up + x),   c = vecLoad(up + x + 1);
+        Vec d = vecLoad(row + x - 1),  e = vecLoad(row + x),  f = vecLoad(row + x + 1);
+        Vec g = vecLoad(down + x - 1), h = vecLoad(down + x), i = vecLoad(down + x + 1);
+
+        Vec corner = vecAndNot(vecEq(b, h), vecAndNot(vecEq(d, f), vecEq(e, e)));
+        Vec db = vecAnd(corner, vecEq(d, b));
+        Vec bf = vecAnd(corner, vecEq(b, f));
+        Vec dh = vecAnd(corner, vecEq(d, h));
+        Vec hf = vecAnd(corner, vecEq(h, f));
+
+        uint32_t blocks[9][VEC_PIXELS];
+        vecStore(blocks[0], vecSelect(db, d, e));
+        vecStore(blocks[1], vecSelect(vecOr(vecAndNot(vecEq(e, c), db), vecAndNot(vecEq(e, a), bf)), b, e));
+        vecStore(blocks[2], vecSelect(bf, f, e));
+        vecStore(blocks[3], vecSelect(vecOr(vecAndNot(vecEq(e, g), db), vecAndNot(vecEq(e, a), dh)), d, e));
+        vecStore(blocks[4], e);
+        vecStore(blocks[5], vecSelect(vecOr(vecAndNot(vecEq(e, i), bf), vecAndNot(vecEq(e, c), hf)), f, e));
+        vecStore(blocks[6], vecSelect(dh, d, e));
+        vecStore(blocks[7], vecSelect(vecOr(vecAndNot(vecEq(e, i), dh), vecAndNot(vecEq(e, g), hf)), h, e));
+        vecStore(blocks[8], vecSelect(hf, f, e));
+
+        // Three to a row doesn't go with the shuffles; spread them out plainly
+        for (int r = 0; r < 3; r++) {
+            uint32_t* dest = out + r * stride + x * 3;
+            for (int p = 0; p < VEC_PIXELS; p++) {
+                dest[p * 3]     = blocks[r * 3][p];
+                dest[p * 3 + 1] = blocks[r * 3 + 1][p];
+                dest[p * 3 + 2] = blocks[r * 3 + 2][p];
+            }
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        uint32_t a = up[x - 1],   b = up[x],   c = up[x + 1];
+        uint32_t d = row[x - 1],  e = row[x],  f = row[x + 1];
+        uint32_t g = down[x - 1], h = down[x], i = down[x + 1];
+
+        bool corner = b != h && d != f;
+        bool db = corner && d == b;
+        bool bf = corner && b == f;
+        bool dh = corner && d == h;
+        bool hf = corner && h == f;
+
+        uint32_t* block = out + x * 3;
+        block[0]              = db ? d : e;
+        block[1]              = (db && e != c) || (bf && e != a) ? b : e;
+        block[2]              = bf ? f : e;
+        block[stride]         = (db && e != g) || (dh && e != a) ? d : e;
+        block[stride + 1]     = e;
+        block[stride + 2]     = (bf && e != i) || (hf && e != c) ? f : e;
+        block[stride * 2]     = dh ? d : e;
+        block[stride * 2 + 1] = (dh && e != i) || (hf && e != g) ? h : e;
+        block[stride * 2 + 2] = hf ? f : e;
+    }
+}
+
+static void copyRow(const uint32_t* up, const uint32_t* row, const uint32_t* down, int width,
+                    uint32_t* out, int stride) {
+    memcpy(out, row, width * sizeof(uint32_t));
+}
+
+/**
+ * Each pixel as a plain 2x2 block: low-res pixels without a filter.
+ */
+static void doubleRow(const uint32_t* up, const uint32_t* row, const uint32_t* down, int width,
+                      uint32_t* out, int stride) {
+    int x = 0;
+#ifdef __SSE2__
+    for (; x + 4 <= width; x += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(row + x));
+        _mm_storeu_si128((__m128i*)(out + x * 2), _mm_unpacklo_epi32(p, p));
+        _mm_storeu_si128((__m128i*)(out + x * 2 + 4), _mm_unpackhi_epi32(p, p));
+    }
+#endif
+    for (; x < width; x++) {
+        out[x * 2] = out[x * 2 + 1] = row[x];
+    }
+    memcpy(out + stride, out, width * 2 * sizeof(uint32_t));
+}
+
+/**
+ * Each pixel as a 4x4 block, the bottom row at half brightness and, for
+ * an LCD, the right column too.
+ */
+static void maskRow(const uint32_t* row, int width, uint32_t* out, int stride, bool lcd) {
+    uint32_t* bottom = out + stride * 3;
+    int x = 0;
+#ifdef __SSE2__
+    // lane 3 of a block is its right column
+    __m128i right = lcd ? _mm_set_epi32(-1, 0, 0, 0) : _mm_setzero_si128();
+    for (; x + 4 <= width; x += 4) {
+        __m128i p     = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i pairs[2] = { _mm_unpacklo_epi32(p, p), _mm_unpackhi_epi32(p, p) };
+        for (int j = 0; j < 4; j++) {
+            __m128i pair  = pairs[j / 2];
+            __m128i block = j % 2 == 0 ? _mm_unpacklo_epi64(pair, pair) : _mm_unpackhi_epi64(pair, pair);
+            __m128i dimmed = dim4(block);
+            __m128i lit    = _mm_or_si128(_mm_and_si128(right, dimmed), _mm_andnot_si128(right, block));
+            _mm_storeu_si128((__m128i*)(out + (x + j) * 4), lit);
+            _mm_storeu_si128((__m128i*)(bottom + (x + j) * 4), dimmed);
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        uint32_t lit = row[x], dimmed = dim(lit);
+        for (int i = 0; i < 4; i++) {
+            out[x * 4 + i]    = lcd && i == 3 ? dimmed : lit;
+            bottom[x * 4 + i] = dimmed;
+        }
+    }
+    memcpy(out + stride, out, width * 4 * sizeof(uint32_t));
+    memcpy(out + stride * 2, out, width * 4 * sizeof(uint32_t));
+}
+
+static void scanlinesRow(const uint32_t* up, const uint32_t* row, const uint32_t* down, int width,
+                         uint32_t* out, int stride) {
+    maskRow(row, width, out, stride, false);
+}
+
+static void lcdRow(const uint32_t* up, const uint32_t* row, const uint32_t* down, int width,
+                   uint32_t* out, int stride) {
+    maskRow(row, width, out, stride, true);
+}
+
+/**
+ * Runs filter over rows [y0, y1) of a width x height image, into out at
+ * factor times the size. Past the edges, the edge pixels repeat.
+ */
+static void filterRows(const uint32_t* in, int width, int height, int y0, int y1, uint32_t* out,
+                       int factor, RowFilter filter) {
+    uint32_t padded[3][MAX_FILTER_WIDTH + 2];
+    int      stride = width * factor;
+
+    for (int y = y0; y < y1; y++) {
+        for (int i = 0; i < 3; i++) {
+            int src = y + i - 1;
+            if (src < 0) src = 0;
+            if (src >= height) src = height - 1;
+            memcpy(padded[i] + 1, in + src * width, width * sizeof(uint32_t));
+            padded[i][0]         = padded[i][1];
+            padded[i][width + 1] = padded[i][width];
+        }
+        filter(padded[0] + 1, padded[1] + 1, padded[2] + 1, width, out + (size_t)y * factor * stride, stride);
+    }
+}
+
+bool Scaler_parseFilter(const char* name, ScaleFilter* filter) {
+    if (strcmp(name, "epx") == 0) { // the same rules as Scale2x, found independently
+        *filter = SCALE_2X;
+        return true;
+    }
+    for (int i = 0; i < SCALE_FILTER_COUNT; i++) {
+        if (strcmp(name, FILTER_NAMES[i]) == 0) {
+            *filter = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scaler_init(Scaler* scaler, ScaleFilter filter, const uint32_t palette[1 << SCREEN_PLANES]) {
+    scaler->filter = filter;
+    scaler->factor = FILTER_FACTORS[filter];
+    scaler->width  = HIRES_WIDTH * scaler->factor;
+    scaler->height = HIRES_HEIGHT * scaler->factor;
+    scaler->primed = false;
+    memcpy(scaler->palette, palette, sizeof(scaler->palette));
+
+    scaler->pixels = calloc((size_t)scaler->width * scaler->height, sizeof(uint32_t));
+    scaler->middle = filter == SCALE_4X ? calloc(MAX_FILTER_WIDTH * HIRES_HEIGHT * 2, sizeof(uint32_t)) : NULL;
+    if (scaler->pixels == NULL || (filter == SCALE_4X && scaler->middle == NULL)) {
+        Scaler_free(scaler);
+        return false;
+    }
+    return true;
+}
+
+void Scaler_free(Scaler* scaler) {
+    free(scaler->pixels);
+    free(scaler->middle);
+    scaler->pixels = NULL;
+    scaler->middle = NULL;
+}
+
+bool Scaler_update(Scaler* scaler, const EmuDisplay* display, int* top, int* bottom) {
+    bool hires  = display->hires;
+    int  width  = hires ? HIRES_WIDTH : SCREEN_WIDTH;
+    int  height = hires ? HIRES_HEIGHT : SCREEN_HEIGHT;
+
+    // The rows that changed, at the display's own resolution
+    bool all = !scaler->primed || scaler->previous.hires != hires;
+    int  t = height, b = 0;
+    for (int y = 0; y < height; y++) {
+        bool changed = all;
+        for (int p = 0; p < SCREEN_PLANES && !changed; p++) {
+            changed = memcmp(display->rows[p][y], scaler->previous.rows[p][y], sizeof(display->rows[p][y])) != 0;
+        }
+        if (!changed) continue;
+        if (y < t) t = y;
+        b = y + 1;
+    }
+    if (t >= b) return false;
+    scaler->previous = *display;
+    scaler->primed   = true;
+
+    for (int y = t; y < b; y++) {
+        uint32_t* row = scaler->source + y * width;
+        for (int x = 0; x < width; x++) {
+            int     shift = 63 - x % 64;
+            uint8_t color = (display->rows[0][y][x / 64] >> shift & 1) | (display->rows[1][y][x / 64] >> shift & 1) << 1;
+            row[x] = scaler->palette[color];
+        }
+    }
+
+    // Low-res up to hi-res. Scale2x looks a row up and down, so a changed
+    // row changes its neighbours' blocks too
+    ScaleFilter     filter = scaler->filter;
+    const uint32_t* base   = scaler->source;
+    if (!hires) {
+        int reach = filter == SCALE_NONE ? 0 : 1;
+        if (t - reach >= 0) t -= reach;
+        if (b + reach <= height) b += reach;
+        filterRows(scaler->source, width, height, t, b, scaler->base, 2, filter == SCALE_NONE ? doubleRow : scale2xRow);
+        base = scaler->base;
+        t *= 2;
+        b *= 2;
+    }
+
+    if (filter == SCALE_2X || filter == SCALE_3X || filter == SCALE_4X) {
+        if (t > 0) t--;
+        if (b < HIRES_HEIGHT) b++;
+    }
+    switch (filter) {
+        case SCALE_NONE:      filterRows(base, HIRES_WIDTH, HIRES_HEIGHT, t, b, scaler->pixels, 1, copyRow);      break;
+        case SCALE_2X:        filterRows(base, HIRES_WIDTH, HIRES_HEIGHT, t, b, scaler->pixels, 2, scale2xRow);   break;
+        case SCALE_3X:        filterRows(base, HIRES_WIDTH, HIRES_HEIGHT, t, b, scaler->pixels, 3, scale3xRow);   break;
+        case SCALE_SCANLINES: filterRows(base, HIRES_WIDTH, HIRES_HEIGHT, t, b, scaler->pixels, 4, scanlinesRow); break;
+        case SCALE_LCD:       filterRows(base, HIRES_WIDTH, HIRES_HEIGHT, t, b, scaler->pixels, 4, lcdRow);       break;
+
+        case SCALE_4X: {
+            filterRows(base, HIRES_WIDTH, HIRES_HEIGHT, t, b, scaler->middle, 2, scale2xRow);
+            t = t > 0 ? t * 2 - 1 : 0;
+            b = b < HIRES_HEIGHT ? b * 2 + 1 : b * 2;
+            filterRows(scaler->middle, MAX_FILTER_WIDTH, HIRES_HEIGHT * 2, t, b, scaler->pixels, 2, scale2xRow);
+            *top    = t * 2;
+            *bottom = b * 2;
+            return true;
+        }
+
+        default:
+            break;
+    }
+
+    *top    = t * scaler->factor;
+    *bottom = b * scaler->factor;
+    return true;
+}
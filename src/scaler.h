@@ -0,0 +1,61 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "emulator.h"
+
+typedef enum {
+    SCALE_NONE,      // 128x64, low-res pixels doubled
+    SCALE_2X,        // Scale2x, which is also EPX
+    SCALE_3X,        // Scale3x
+    SCALE_4X,        // Scale2x twice
+    SCALE_SCANLINES, // 4x4 blocks with the bottom row dimmed
+    SCALE_LCD,       // 4x4 blocks with the bottom row and right column dimmed
+    SCALE_FILTER_COUNT
+} ScaleFilter;
+
+/**
+ * Turns displays into the ARGB picture for the streaming texture, through
+ * one of the filters, on the render thread. It keeps the last display and
+ * only redoes the rows that changed since, with the neighbours the filter
+ * looks at. With a filter on, low-res screens are brought up to hi-res by
+ * Scale2x rather than doubling, so the smoothing happens at their own
+ * resolution.
+ */
+typedef struct {
+    ScaleFilter filter;
+    int         factor; // output pixels per hi-res pixel, each way
+    int         width;  // of pixels
+    int         height;
+    uint32_t*   pixels; // the picture, width * height
+    uint32_t    palette[1 << SCREEN_PLANES];
+
+    uint32_t    source[HIRES_WIDTH * HIRES_HEIGHT]; // the display in colours, at its own resolution
+    uint32_t    base[HIRES_WIDTH * HIRES_HEIGHT];   // a low-res display brought up to hi-res
+    uint32_t*   middle;                             // SCALE_4X's first pass
+    EmuDisplay  previous;
+    bool        primed; // previous holds a display
+} Scaler;
+
+/**
+ * Maps "none", "scale2x", "epx", "scale3x", "scale4x", "scanlines" or "lcd"
+ * to a filter. Returns false for anything else.
+ */
+bool Scaler_parseFilter(const char* name, ScaleFilter* filter);
+
+/**
+ * Allocates the picture for filter, in the colours of palette (ARGB, per
+ * EmuDisplay_pixel index). Returns false if out of memory.
+ */
+bool Scaler_init(Scaler* scaler, ScaleFilter filter, const uint32_t palette[1 << SCREEN_PLANES]);
+void Scaler_free(Scaler* scaler);
+
+/**
+ * Brings pixels up to date with display. Returns false if nothing changed;
+ * otherwise rows [*top, *bottom) of pixels are new.
+ */
+bool Scaler_update(Scaler* scaler, const EmuDisplay* display, int* top, int* bottom);
+
+#endif
@@ -0,0 +1,39 @@
+#include <stdlib.h>
+
+#include "triplebuffer.h"
+
+bool TripleBuffer_init(TripleBuffer* tb, size_t size) {
+    tb->data = calloc(3, size);
+    if (tb->data == NULL) return false;
+    tb->size       = size;
+    tb->writeIndex = 0;
+    tb->middle     = 1;
+    tb->readIndex  = 2;
+    return true;
+}
+
+void TripleBuffer_free(TripleBuffer* tb) {
+    free(tb->data);
+    tb->data = NULL;
+}
+
+void* TripleBuffer_writeBuffer(TripleBuffer* tb) {
+    return tb->data + tb->writeIndex * tb->size;
+}
+
+void TripleBuffer_publish(TripleBuffer* tb) {
+    // Release makes the frame visible before the index; acquire picks up
+    // the reader's last use of the buffer we get back
+    uint32_t prev = atomic_exchange_explicit(&tb->middle, tb->writeIndex | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    tb->writeIndex = prev & 3;
+}
+
+const void* TripleBuffer_read(TripleBuffer* tb, bool* fresh) {
+    bool isFresh = (atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH) != 0;
+    if (isFresh) {
+        uint32_t prev = atomic_exchange_explicit(&tb->middle, tb->readIndex, memory_order_acq_rel);
+        tb->readIndex = prev & 3;
+    }
+    if (fresh) *fresh = isFresh;
+    return tb->data + tb->readIndex * tb->size;
+}
@@ -0,0 +1,45 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+ * Lock-free triple buffer for handing whole frames from one writer thread
+ * to one reader thread. The writer always has a buffer to fill and the
+ * reader always has the newest complete one; neither ever waits, and
+ * frames the reader was too slow to see are simply replaced.
+ */
+typedef struct {
+    uint8_t*    data; // three buffers of size bytes
+    size_t      size;
+    uint32_t    writeIndex; // owned by the writer
+    uint32_t    readIndex;  // owned by the reader
+    atomic_uint middle;     // the spare buffer, | TRIPLE_BUFFER_FRESH while it holds an unread frame
+} TripleBuffer;
+
+#define TRIPLE_BUFFER_FRESH 4
+
+bool TripleBuffer_init(TripleBuffer* tb, size_t size);
+void TripleBuffer_free(TripleBuffer* tb);
+
+/**
+ * Writer side: the buffer to fill next. Its contents are stale, so fill
+ * all of it before publishing.
+ */
+void* TripleBuffer_writeBuffer(TripleBuffer* tb);
+
+/**
+ * Writer side: makes the filled buffer the newest frame.
+ */
+void TripleBuffer_publish(TripleBuffer* tb);
+
+/**
+ * Reader side: the newest published frame. fresh (may be NULL) is set to
+ * whether it wasn't returned before. Stays valid until the next call.
+ */
+const void* TripleBuffer_read(TripleBuffer* tb, bool* fresh);
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "watch.h"
+
+#ifdef __linux__
+static bool isSourceName(const char* name) {
+    size_t len = strlen(name);
+    return len > 4 && (strcmp(name + len - 4, ".asm") == 0 || strcmp(name + len - 4, ".src") == 0);
+}
+#endif
+
+static void readMtime(const char* path, time_t* mtime, long* nsec) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        *mtime = 0;
+        *nsec  = 0;
+        return;
+    }
+    *mtime = st.st_mtime;
+#if defined(__APPLE__)
+    *nsec = st.st_mtimespec.tv_nsec;
+#else
+    *nsec = st.st_mtim.tv_nsec;
+#endif
+}
+
+bool FileWatch_init(FileWatch* watch, const char* path) {
+    watch->path = path;
+    readMtime(path, &watch->mtime, &watch->mtimeNsec);
+
+#ifdef __linux__
+    // Watch the directory, not the file: editors often save by writing a
+    // new file and renaming it over the old one, and INCLUDEd files usually
+    // live alongside
+    char dir[4096];
+    const char* slash = strrchr(path, '/');
+    if (slash) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+        if (dir[0] == '\0') strcpy(dir, "/");
+    } else {
+        strcpy(dir, ".");
+    }
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd >= 0 && inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        close(watch->fd);
+        watch->fd = -1;
+    }
+    if (watch->fd < 0) printf("inotify unavailable, polling %s\n", path);
+#endif
+
+    return watch->mtime != 0;
+}
+
+bool FileWatch_poll(FileWatch* watch) {
+#ifdef __linux__
+    if (watch->fd >= 0) {
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        bool changed = false;
+        ssize_t n;
+        while ((n = read(watch->fd, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + n; ) {
+                struct inotify_event* event = (struct inotify_event*)p;
+                if (event->len > 0 && isSourceName(event->name)) changed = true;
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+#endif
+
+    time_t mtime;
+    long   nsec;
+    readMtime(watch->path, &mtime, &nsec);
+    if (mtime == 0 || (mtime == watch->mtime && nsec == watch->mtimeNsec)) return false;
+    watch->mtime     = mtime;
+    watch->mtimeNsec = nsec;
+    return true;
+}
+
+void FileWatch_close(FileWatch* watch) {
+#ifdef __linux__
+    if (watch->fd >= 0) close(watch->fd);
+    watch->fd = -1;
+#endif
+}
@@ -0,0 +1,31 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <time.h>
+
+/**
+ * Notices when a source file, or another source file next to it, is saved.
+ * Uses inotify on Linux and falls back to comparing modification times.
+ */
+typedef struct {
+    const char* path;
+    time_t      mtime;
+    long        mtimeNsec;
+#ifdef __linux__
+    int         fd; // inotify instance on the file's directory, -1 if unavailable
+#endif
+} FileWatch;
+
+bool FileWatch_init(FileWatch* watch, const char* path);
+
+/**
+ * Returns true if anything was saved since the last call. Never blocks.
+ * Without inotify every call costs a stat(), so poll a few times a second
+ * rather than every cycle.
+ */
+bool FileWatch_poll(FileWatch* watch);
+
+void FileWatch_close(FileWatch* watch);
+
+#endif